@@ -1,4 +1,7 @@
 #include "MOctree.h"
+#include "MOctreeCode.h"
+#include "MOctreeStream.h"
+#include "MTaskScheduler.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 #define STB_IMAGE_IMPLEMENTATION
@@ -65,11 +68,18 @@ int main(int argc, char* argv[])
     m.loadModel("models/animals/PSX_shark.obj");
     //m.loadModel("models/Car/Datsun_280Z.obj");
     
+    OctreeArena occArena;
+    OctreeArena occ2Arena;
+    OctreeArena boolOpArena;
     OctreeNode Occ{};
     OctreeNode Occ2{};
     OctreeNode boolOpTree{};
     boolOpTree.posMin.pos = glm::vec3(-5.0f, -5.0f, -5.0f);
     boolOpTree.posMax.pos = glm::vec3(5.0f, 5.0f, 5.0f);
+    // Translation and scale only move Occ through occTree's transform
+    Octree occTree{&Occ};
+    LinearOctree linearOcc{};
+    LinearOctree linearBoolOpTree{};
     
     bool bBuildModel = false;
     bool bBuildSphere = false;
@@ -77,12 +87,39 @@ int main(int argc, char* argv[])
     bool bBuildCylinder = false;
     Operation OP = UNION;
     bool bInput = false;
+    // Read IO/input.moct and write IO/output.moct instead of the text codes
+    bool bBinaryIO = false;
+    // Volume and mesh straight off the mapped input file, without the code string or a tree
+    bool bStreamInput = false;
+    bool bLinearOctree = false;
+    bool bParallelBuild = false;
+    int parallelDepth = 3;
     bool bShowModel = false;
+    // Faces bordering empty space merged into rectangles, the whole cube of every leaf with MESH_CUBES
+    MeshMode meshMode = MESH_GREEDY_FACES;
+    // Welded vertices and 16-bit indices when they fit
+    bool bIndexedMesh = true;
+    // Every BLACK leaf as an instance of one unit cube, drawn with a single call; needs shaders/instanced_vert.spv
+    bool bInstancedCubes = false;
+    // With bInstancedCubes, the cut of the tree picked each frame from the camera distance
+    bool bLevelOfDetail = false;
+    // Mesh split by the octree nodes at meshChunkDepth, drawing only the chunks in view each frame
+    bool bChunkCulling = false;
+    uint8_t meshChunkDepth = 2;
     bool bBoolOperation = false;
     bool bTranslate = false;
     bool bScale = false;
     glm::vec3 translationVector = glm::vec3{3.f,3.f,3.f};
     float scalar = 3.0f;
+    // Quarter turns about rotationAxis, then the mirror across mirrorAxis, by rewriting the code
+    bool bRotate = false;
+    int rotationAxis = 2;
+    int quarterTurns = 1;
+    bool bMirror = false;
+    int mirrorAxis = 0;
+    // Any affine map, resampled from Occ at the same depth
+    bool bResample = false;
+    glm::mat4 resampleTransform = glm::scale(glm::rotate(glm::mat4(1.0f), glm::radians(30.0f), glm::vec3(0.0f, 0.0f, 1.0f)), glm::vec3(1.0f, 0.5f, 1.0f));
 
     bool bCalculateVolume = true;
     bool bCalculateArea = false;
@@ -94,68 +131,204 @@ int main(int argc, char* argv[])
     Cone cone = {{glm::vec3(3.0f, 3.0f, 3.0f)},2.5f, 6.0f, glm::vec3(0.0f, 0.0f, 0.0f)};
     
     
-    if(bInput)
+    std::unique_ptr<MTaskScheduler> scheduler = bParallelBuild ? std::make_unique<MTaskScheduler>() : nullptr;
+
+    if(bInput && bStreamInput)
+    {
+        MMappedFile inputFile(bBinaryIO ? "IO/input.moct" : "IO/input.txt");
+        if(bCalculateVolume)
+            std::cout << "Volume: " << getOctreeVolume(inputFile) << std::endl;
+
+        m.vertices.clear();
+        m.indices.clear();
+        m.currentIndex = 0;
+        populateFromOctree(inputFile, m.vertices, m.indices, m.currentIndex);
+
+        MRenderer program;
+        program.run(m.vertices, m.indices);
+        return 0;
+    }
+
+    if(bInput && bBinaryIO)
+    {
+        BinaryOctreeCode inputCode = readBinaryCode("IO/input.moct");
+        code = decodeBinaryCode(inputCode);
+        if(bLinearOctree)
+            linearOcc = buildLinearTreeFromCode(code, inputCode.posMin, inputCode.posMax);
+        else
+            Occ = buildTreeFromBinaryCode(inputCode, occArena);
+    }
+    else if(bInput)
     {
         code = getInputCode();
-        Occ = buildTreeFromCode(code);
+        if(bLinearOctree)
+            linearOcc = buildLinearTreeFromCode(code);
+        else
+            Occ = buildTreeFromCode(code, occArena);
+    }
+    else if(bLinearOctree)
+    {
+        if(bBuildModel)
+        {
+            linearOcc = createLinearOctree(buildInitialBoundingBox(m));
+            buildTree(m, linearOcc, depth, code, scheduler.get(), parallelDepth);
+        }
+        else if(bBuildBlock)
+        {
+            linearOcc = createLinearOctree(createNodeForBlock(block));
+            buildTree(block, linearOcc, depth, code, scheduler.get(), parallelDepth);
+        }
+        else if(bBuildSphere)
+        {
+            linearOcc = createLinearOctree(createNodeForSphere(sphere));
+            buildTree(sphere, linearOcc, depth, code, scheduler.get(), parallelDepth);
+        }
+        else if(bBuildCylinder)
+        {
+            linearOcc = createLinearOctree(createNodeForCylinder(cylinder));
+            buildTree(cylinder, linearOcc, depth, code, scheduler.get(), parallelDepth);
+        }
+        else
+        {
+            linearOcc = createLinearOctree(createNodeForCone(cone));
+            buildTree(cone, linearOcc, depth, code, scheduler.get(), parallelDepth);
+        }
     }
     else
     {
         if(bBuildModel)
         {
             Occ = buildInitialBoundingBox(m);
-            buildTree(cylinder, Occ, depth, code);
+            buildTree(m, Occ, occArena, depth, code, scheduler.get(), parallelDepth);
         }
         else if(bBuildBlock)
         {
             Occ = createNodeForBlock(block);
-            buildTree(cylinder, Occ, depth, code);
+            buildTree(block, Occ, occArena, depth, code, scheduler.get(), parallelDepth);
         }
         else if(bBuildSphere)
         {
             Occ = createNodeForSphere(sphere);
-            buildTree(cylinder, Occ, depth, code);
+            buildTree(sphere, Occ, occArena, depth, code, scheduler.get(), parallelDepth);
         }
         else if(bBuildCylinder)
         {
             Occ =  createNodeForCylinder(cylinder);
-            buildTree(cylinder, Occ, depth, code);
+            buildTree(cylinder, Occ, occArena, depth, code, scheduler.get(), parallelDepth);
         }
         else
         {
             Occ = createNodeForCone(cone);
-            buildTree(cylinder, Occ, depth, code);
+            buildTree(cone, Occ, occArena, depth, code, scheduler.get(), parallelDepth);
         }
     }
 
+    if(bRotate || bMirror)
+    {
+        OctreeSymmetry symmetry;
+        if(bRotate)
+            symmetry = makeOctreeRotation(rotationAxis, quarterTurns);
+        if(bMirror)
+            symmetry = combineOctreeSymmetries(symmetry, makeOctreeMirror(mirrorAxis));
+
+        code = transformOctreeCode(code, symmetry);
+        if(bLinearOctree)
+        {
+            transformOctreeBounds(symmetry, linearOcc.posMin, linearOcc.posMax);
+            linearOcc = buildLinearTreeFromCode(code, linearOcc.posMin, linearOcc.posMax);
+        }
+        else
+        {
+            glm::vec3 posMin = Occ.posMin.pos;
+            glm::vec3 posMax = Occ.posMax.pos;
+            transformOctreeBounds(symmetry, posMin, posMax);
+            occArena.reset();
+            Occ = buildTreeFromCode(code, occArena, posMin, posMax);
+        }
+    }
     
+    if(bResample && !bLinearOctree)
+    {
+        OctreeArena resampledArena;
+        OctreeNode resampled = buildResampledBoundingBox(Occ, resampleTransform);
+        code.clear();
+        buildTreeFromResampling(Occ, resampleTransform, resampled, resampledArena, depth, code, scheduler.get(), parallelDepth);
+        occArena = std::move(resampledArena);
+        Occ = resampled;
+    }
+
     if(bTranslate)
     {
-        Occ = buildTreeFromCode(code, Occ.posMin.pos + translationVector, Occ.posMax.pos + translationVector);
+        if(bLinearOctree)
+        {
+            linearOcc.posMin += translationVector;
+            linearOcc.posMax += translationVector;
+        }
+        else
+        {
+            translateOctree(occTree, translationVector);
+        }
     }
 
     if(bScale)
     {
-        Occ = buildTreeFromCode(code, Occ.posMin.pos * scalar, Occ.posMax.pos * scalar);
+        if(bLinearOctree)
+        {
+            linearOcc.posMin *= scalar;
+            linearOcc.posMax *= scalar;
+        }
+        else
+        {
+            scaleOctree(occTree, scalar);
+        }
     }
     
-    std::ofstream outputFile("IO/output.txt");
-    if (!outputFile)
+    if(bBinaryIO)
     {
-        std::cerr << "Error opening output file!" << std::endl;
+        if(bLinearOctree)
+            writeBinaryCode(encodeBinaryCode(code, linearOcc.posMin, linearOcc.posMax), "IO/output.moct");
+        else
+            writeBinaryCode(encodeBinaryCode(occTree), "IO/output.moct");
     }
     else
     {
-        outputFile << code;
-        outputFile.close();
+        std::ofstream outputFile("IO/output.txt");
+        if (!outputFile)
+        {
+            std::cerr << "Error opening output file!" << std::endl;
+        }
+        else
+        {
+            outputFile << code;
+            outputFile.close();
+        }
     }
 
     if(bBoolOperation)
     {
         std::string code2 = "((WWW(WW(WBWBBBBB)(BBBBBBWW)(WWBBWWBB)W(BBBBBBBB)(BBBWBBBW))WWW((WWBBWWWW)W(BBBBWBWB)(BBBWBBWW)WW(WBWBWBWB)(BBWWBBWW)))(WW(WW(BBBBBBWW)(BWBWBBBB)W(WWBBWWBB)(BBWBBBWB)(BBBBBBBB))WWW(W(WWBBWWWW)(BBWBBBWW)(BBBBBWBW)WW(BBWWBBWW)(BWBWBWBW))W)(W((WBWWWBWB)(BBWWBBBB)WW(BBWBBBWB)(BBBBBBBB)W(WWWWBBWW))WWW((BBWBWBWB)(BBBBBBBB)(WBWWWBWW)(BBWWBBWW)(WBWBBBBB)(BBBBBBBB)(WBWWWWWW)(BBWWBBWW))WW)(((BBWWBBBB)(BWWWBWBW)WW(BBBBBBBB)(BBBWBBBW)(WWWWBBWW)W)WWW((BBBBBBBB)(BBBWBWBW)(BBWWBBWW)(BWWWBWWW)(BBWBBBBB)(BWBWBBBB)(BBWWBBWW)(BWWWWWWW))WWW)(WWW(WW(BBBBBBBB)(BBWWBBWW)(WWWWWWBB)W(BBBBBBBB)(BBBWBBBW))WWW((WWBBWWWW)W(BBBBBBBB)(BBBWBBBW)WW(WBWBWBWB)(BBBBBBBB)))(WW(WW(BBWWBBWW)(BBBBBBBB)W(WWWWWWBB)(BBWBBBWB)(BBBBBBBB))WWW(W(WWBBWWWW)(BBWBBBWB)(BBBBBBBB)WW(BBBBBBBB)(BWBWBWBW))W)(W((BBWBBBWW)(BBBBBBWB)WW(BBWWBBWW)(BBWWBBWW)WW)WWW((BBWWWBWW)(BBWWBBWW)WWW(BBWWWWWW)WW)WW)(((BBBBBBWW)(BBBWBBWW)WW(BBWWBBWW)(BBWWBBWW)WW)WWW((BBWWBBWW)(BBWWBWWW)WW(BBWWWWWW)WWW)WWW))";
-        Occ2 = buildTreeFromCode(code2);
-        buildTreeFromBooleanOperation(Occ, Occ2, boolOpTree, UNION, boolCode);
-        boolOpTree = buildTreeFromCode(boolCode);
+        if(bLinearOctree)
+        {
+            buildTreeFromBooleanOperation(linearOcc, buildLinearTreeFromCode(code2), linearBoolOpTree, UNION, boolCode);
+        }
+        else
+        {
+            boolOpArena.reset();
+            if(bParallelBuild)
+            {
+                // Both trees are needed to split the work between tasks. Occ2 is read in Occ's box so the two line up
+                Occ2 = buildTreeFromCode(code2, occ2Arena, Occ.posMin.pos, Occ.posMax.pos);
+                Octree occ2Tree{&Occ2, occTree.translation, occTree.scale};
+                Octree boolOpPlaced{&boolOpTree};
+                buildTreeFromBooleanOperation(occTree, occ2Tree, boolOpPlaced, boolOpArena, UNION, boolCode, scheduler.get(), parallelDepth);
+            }
+            else
+            {
+                // Straight from the two codes, only the result is decoded into a tree
+                buildCodeFromBooleanOperation(code, code2, UNION, boolCode);
+                boolOpTree = buildTreeFromCode(boolCode, boolOpArena);
+            }
+        }
         std::cout << boolCode << std::endl;
     }
     
@@ -168,13 +341,50 @@ int main(int argc, char* argv[])
     }
     
     if(bCalculateVolume)
-        std::cout << "Volume: " << getOctreeVolume(&Occ) << std::endl;
-    if(bCalculateArea)
-        std::cout << "Area: " << getOctreeArea(Occ) << std::endl;
+        std::cout << "Volume: " << (bLinearOctree ? getOctreeVolume(linearOcc) : getOctreeVolume(occTree)) << std::endl;
+    if(bCalculateArea && !bLinearOctree)
+        std::cout << "Area: " << getOctreeArea(occTree) << std::endl;
 
-    populateFromOctree(&Occ, m.vertices, m.indices, m.currentIndex);
-    
     MRenderer program;
+    if(bInstancedCubes && !bLinearOctree)
+    {
+        if(bLevelOfDetail)
+        {
+            program.run(m.vertices, m.indices, occTree);
+            return 0;
+        }
+        std::vector<CubeInstance> instances;
+        populateCubeInstances(occTree, instances);
+        program.run(m.vertices, m.indices, instances, getCubeRootExtent(occTree));
+        return 0;
+    }
+
+    if(bIndexedMesh && !bLinearOctree)
+    {
+        IndexedMesh mesh{std::move(m.vertices), {}, std::move(m.indices)};
+        appendIndexedMesh(occTree, meshMode, mesh);
+        if(mesh.indices.empty())
+        {
+            if(bChunkCulling)
+                program.setMeshChunks(chunkMeshByOctree(occTree, meshChunkDepth, mesh.vertices, mesh.shortIndices));
+            program.run(mesh.vertices, mesh.shortIndices);
+        }
+        else
+        {
+            if(bChunkCulling)
+                program.setMeshChunks(chunkMeshByOctree(occTree, meshChunkDepth, mesh.vertices, mesh.indices));
+            program.run(mesh.vertices, mesh.indices);
+        }
+        return 0;
+    }
+
+    if(bLinearOctree)
+        populateFromOctree(linearOcc, m.vertices, m.indices, m.currentIndex);
+    else
+        populateFromOctree(occTree, m.vertices, m.indices, m.currentIndex, meshMode);
+    if(bChunkCulling && !bLinearOctree)
+        program.setMeshChunks(chunkMeshByOctree(occTree, meshChunkDepth, m.vertices, m.indices));
+    
     program.run(m.vertices, m.indices);
     
     return 0;
@@ -0,0 +1,45 @@
+﻿#include "MFrustum.h"
+
+Frustum extractFrustum(const glm::mat4& clip)
+{
+	// glm is column major, so row i of the matrix is clip[0][i], clip[1][i], clip[2][i], clip[3][i]
+	glm::vec4 rows[4];
+	for(int i = 0; i < 4; ++i)
+	{
+		rows[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+	}
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0];
+	frustum.planes[1] = rows[3] - rows[0];
+	frustum.planes[2] = rows[3] + rows[1];
+	frustum.planes[3] = rows[3] - rows[1];
+	frustum.planes[4] = rows[2];
+	frustum.planes[5] = rows[3] - rows[2];
+	return frustum;
+}
+
+FrustumSide classifyBox(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	FrustumSide side = FRUSTUM_INSIDE;
+	for(const glm::vec4& plane : frustum.planes)
+	{
+		// The corners furthest along and against the plane normal
+		glm::vec3 positive = boxMin;
+		glm::vec3 negative = boxMax;
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			if(plane[axis] >= 0.f)
+			{
+				positive[axis] = boxMax[axis];
+				negative[axis] = boxMin[axis];
+			}
+		}
+
+		if(plane.x * positive.x + plane.y * positive.y + plane.z * positive.z + plane.w < 0.f)
+			return FRUSTUM_OUTSIDE;
+		if(plane.x * negative.x + plane.y * negative.y + plane.z * negative.z + plane.w < 0.f)
+			side = FRUSTUM_INTERSECTS;
+	}
+	return side;
+}
@@ -0,0 +1,21 @@
+﻿#pragma once
+#include <array>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+/*
+ * The six planes bounding what a projection keeps, as (normal, offset) with the normal
+ * pointing inside: left, right, bottom, top, near and far. Planes are not normalized.
+ */
+struct Frustum
+{
+	std::array<glm::vec4, 6> planes;
+};
+
+enum FrustumSide {FRUSTUM_OUTSIDE, FRUSTUM_INTERSECTS, FRUSTUM_INSIDE};
+
+// From the clip matrix (projection * view * model), clipping depth to [0, w] as Vulkan does
+Frustum extractFrustum(const glm::mat4& clip);
+// Conservative: a box near a frustum corner may come out INTERSECTS while outside
+FrustumSide classifyBox(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax);
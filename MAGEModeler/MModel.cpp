@@ -1,4 +1,6 @@
 ﻿#include "MModel.h"
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
 
 
 void MModel::loadModel(std::string MODEL_PATH)
@@ -42,15 +44,15 @@ void MModel::loadModel(std::string MODEL_PATH)
 			}
 		}
 	
+	triangles.clear();
 	for (size_t s = 0; s < shapes.size(); s++) {
-		// Loop over faces(polygon)
+		// Loop over faces(polygon), fanning each into triangles around its first vertex
 		size_t index_offset = 0;
 		for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
 			size_t fv = size_t(shapes[s].mesh.num_face_vertices[f]);
-			// Loop over vertices in the face.
-			
-			Face newFace{};
-			std::list<Vertex> newVertexList{};
+
+			glm::vec3 first{};
+			glm::vec3 previous{};
 			for (size_t v = 0; v < fv; v++) {
 				// access to vertex
 				tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
@@ -58,11 +60,43 @@ void MModel::loadModel(std::string MODEL_PATH)
 				tinyobj::real_t vx = attrib.vertices[3*size_t(idx.vertex_index)+0];
 				tinyobj::real_t vy = attrib.vertices[3*size_t(idx.vertex_index)+1];
 				tinyobj::real_t vz = attrib.vertices[3*size_t(idx.vertex_index)+2];
-				newVertexList.push_back(Vertex {{vx, vy, vz}});
+				glm::vec3 position(vx, vy, vz);
+				if (v == 0) {
+					first = position;
+				}
+				else if (v >= 2) {
+					triangles.addTriangle(first, previous, position);
+				}
+				previous = position;
 			}
 			index_offset += fv;
-			newFace.vertexList = newVertexList;
-			facesList.push_back(newFace);
 		}
 	}
 }
+
+void TriangleStore::addTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+{
+	const glm::vec3 corners[3] = {v0, v1, v2};
+	for (int corner = 0; corner < 3; ++corner) {
+		coords[3 * corner + 0].push_back(corners[corner].x);
+		coords[3 * corner + 1].push_back(corners[corner].y);
+		coords[3 * corner + 2].push_back(corners[corner].z);
+	}
+
+	boundsMin.push_back(glm::min(v0, glm::min(v1, v2)));
+	boundsMax.push_back(glm::max(v0, glm::max(v1, v2)));
+
+	const glm::vec3 normal = glm::cross(v1 - v0, v2 - v0);
+	const float length = glm::length(normal);
+	normals.push_back(length > 0.0f ? normal / length : glm::vec3(0.0f));
+}
+
+void TriangleStore::clear()
+{
+	for (std::vector<float>& coord : coords) {
+		coord.clear();
+	}
+	boundsMin.clear();
+	boundsMax.clear();
+	normals.clear();
+}
@@ -1,7 +1,6 @@
 ﻿#pragma once
 #include <array>
 #include <iostream>
-#include <list>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -51,6 +50,41 @@ struct Vertex
 	}
 };
 
+/*
+ * One BLACK leaf drawn as an instance of the unit cube: the corner at posMin and the leaf's
+ * depth, which scales the root box extent in the vertex shader so the root need not be a cube.
+ * Fed at binding 1 at instance rate, locations 3 and 4.
+ */
+struct CubeInstance
+{
+	glm::vec3 posMin;
+	uint32_t depth;
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 1;
+		bindingDescription.stride = sizeof(CubeInstance);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+		return bindingDescription;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+
+		attributeDescriptions[0].binding = 1;
+		attributeDescriptions[0].location = 3;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[0].offset = offsetof(CubeInstance, posMin);
+
+		attributeDescriptions[1].binding = 1;
+		attributeDescriptions[1].location = 4;
+		attributeDescriptions[1].format = VK_FORMAT_R32_UINT;
+		attributeDescriptions[1].offset = offsetof(CubeInstance, depth);
+
+		return attributeDescriptions;
+	}
+};
+
 namespace std {
 	template<> struct hash<Vertex> {
 		size_t operator()(Vertex const& vertex) const {
@@ -59,15 +93,30 @@ namespace std {
 	};
 }
 
-struct Face
+/*
+ * Every polygon of a model fanned into triangles once at load, as structure of arrays:
+ * coords[0..2] hold v0.xyz, coords[3..5] v1.xyz and coords[6..8] v2.xyz of triangle i at
+ * index i, the layout the octree builder feeds to the triangle/box test.
+ */
+struct TriangleStore
 {
-	std::list<Vertex> vertexList;
+	std::array<std::vector<float>, 9> coords;
+	std::vector<glm::vec3> boundsMin;
+	std::vector<glm::vec3> boundsMax;
+	// Unit length, zero for degenerate triangles
+	std::vector<glm::vec3> normals;
+
+	size_t size() const { return normals.size(); }
+
+	void addTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2);
+	void clear();
 };
 
 class MModel
 {
 public:
-	std::list<Face> facesList;
+	TriangleStore triangles;
+	// The mesh as loaded, drawn next to the octree when bShowModel is set; the builder only reads triangles
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
 	uint32_t currentIndex = 0;
@@ -1,103 +1,93 @@
 ﻿#include "MOctree.h"
+#include "MTaskScheduler.h"
+#include "MTriangleBox.h"
+#include <cmath>
+#include <limits>
+#include <tuple>
+#include <unordered_map>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/matrix.hpp>
+
+/*
+ * Classifier policies for the build engines. classify() answers WHITE when the node's box
+ * misses the shape, BLACK when the shape fills it and GREY when it has to be subdivided.
+ * It is called once per visited node, so keep it inlinable. State is what a
+ * node hands down to its children; the root gets getRootState().
+ */
+struct MeshClassifier
+{
+	// Triangles that survived the parent box, so a child only tests what can still reach it
+	using State = std::vector<uint32_t>;
 
-void projectVertices(const std::vector<glm::vec3>& vertices, const glm::vec3& axis, float& min, float& max) {
-	min = max = glm::dot(vertices[0], axis);
-	for (size_t i = 1; i < vertices.size(); ++i) {
-		float projection = glm::dot(vertices[i], axis);
-		min = std::min(min, projection);
-		max = std::max(max, projection);
-	}
-}
-
-void projectVertices(const std::array<glm::vec3, 8>& vertices, const glm::vec3& axis, float& min, float& max) {
-	min = max = glm::dot(vertices[0], axis);
-	for (size_t i = 1; i < vertices.size(); ++i) {
-		float projection = glm::dot(vertices[i], axis);
-		min = std::min(min, projection);
-		max = std::max(max, projection);
-	}
-}
-
-bool checkCollisionSAT(const std::array<glm::vec3, 8>& cubeVertices, const std::vector<glm::vec3>& faceVertices) {
-    // Eixos do cubo
-    std::array<glm::vec3, 3> cubeAxes = {
-        glm::vec3(1, 0, 0),
-        glm::vec3(0, 1, 0),
-        glm::vec3(0, 0, 1)
-    };
-
-    // Eixo normal da face
-    glm::vec3 faceNormal = glm::normalize(glm::cross(faceVertices[1] - faceVertices[0], faceVertices[2] - faceVertices[0]));
-
-    // Eixos derivados das arestas
-    std::vector<glm::vec3> edgeAxes;
-    for (size_t i = 0; i < faceVertices.size(); ++i) {
-        glm::vec3 edge = faceVertices[(i + 1) % faceVertices.size()] - faceVertices[i];
-        for (const auto& cubeAxis : cubeAxes) {
-            edgeAxes.push_back(glm::normalize(glm::cross(edge, cubeAxis)));
-        }
-    }
-
-    // Combinar todos os eixos
-    std::vector<glm::vec3> axes;
-    axes.insert(axes.end(), cubeAxes.begin(), cubeAxes.end());
-    axes.push_back(faceNormal);
-    axes.insert(axes.end(), edgeAxes.begin(), edgeAxes.end());
-
-    // Testar separação para cada eixo
-    for (const auto& axis : axes) {
-        if (axis == glm::vec3(0, 0, 0)) {
-            continue;
-        }
-
-        float minCube, maxCube;
-        projectVertices(cubeVertices, axis, minCube, maxCube);
+	explicit MeshClassifier(const MModel& model) : triangles(model.triangles) {}
 
-        float minFace, maxFace;
-        projectVertices(faceVertices, axis, minFace, maxFace);
+	State getRootState() const;
+	NodeCode classify(const OctreeNode& oct, const State& candidates, State& survivors) const;
 
-        if (maxCube < minFace || maxFace < minCube) {
-            return false; // Separação encontrada
-        }
-    }
+	const TriangleStore& triangles;
+};
 
-    return true; // Nenhuma separação encontrada, colisão ocorre
+MeshClassifier::State MeshClassifier::getRootState() const
+{
+	State candidates(triangles.size());
+	for (uint32_t i = 0; i < candidates.size(); ++i) {
+		candidates[i] = i;
+	}
+	return candidates;
 }
 
+NodeCode MeshClassifier::classify(const OctreeNode& oct, const State& candidates, State& survivors) const {
+	survivors.clear();
+	if (candidates.empty()) {
+		return WHITE;
+	}
 
-
-NodeCode classify(MModel& model, OctreeNode& oct) {
-	glm::vec3 cubeMin = oct.posMin.pos;
-	glm::vec3 cubeMax = oct.posMax.pos;
-
-	// Calcular os 8 vértices do cubo
-	std::array<glm::vec3, 8> cubeVertices = {
-		glm::vec3(cubeMin.x, cubeMin.y, cubeMin.z),
-		glm::vec3(cubeMax.x, cubeMin.y, cubeMin.z),
-		glm::vec3(cubeMin.x, cubeMax.y, cubeMin.z),
-		glm::vec3(cubeMax.x, cubeMax.y, cubeMin.z),
-		glm::vec3(cubeMin.x, cubeMin.y, cubeMax.z),
-		glm::vec3(cubeMax.x, cubeMin.y, cubeMax.z),
-		glm::vec3(cubeMin.x, cubeMax.y, cubeMax.z),
-		glm::vec3(cubeMax.x, cubeMax.y, cubeMax.z)
+	const glm::vec3 boxMin = oct.posMin.pos;
+	const glm::vec3 boxMax = oct.posMax.pos;
+	const glm::vec3 boxCenter = (boxMin + boxMax) * 0.5f;
+	const glm::vec3 boxHalfSize = (boxMax - boxMin) * 0.5f;
+
+	TriangleBatch batch;
+	uint32_t batchTriangles[TRIANGLE_BATCH_WIDTH];
+	auto flush = [&]() {
+		const uint32_t hits = triBoxOverlap(batch, boxCenter, boxHalfSize);
+		for (uint32_t lane = 0; lane < batch.count; ++lane) {
+			if (hits & (1u << lane)) {
+				survivors.push_back(batchTriangles[lane]);
+			}
+		}
+		batch.count = 0;
 	};
 
-	for (const Face& face : model.facesList) {
-		std::vector<glm::vec3> faceVertices;
-		for (const Vertex& vertex : face.vertexList) {
-			faceVertices.push_back(vertex.pos);
+	for (const uint32_t triangle : candidates) {
+		// Most candidates that miss the box already miss it with their bounds
+		const glm::vec3& triangleMin = triangles.boundsMin[triangle];
+		const glm::vec3& triangleMax = triangles.boundsMax[triangle];
+		if (triangleMin.x > boxMax.x || triangleMin.y > boxMax.y || triangleMin.z > boxMax.z ||
+			triangleMax.x < boxMin.x || triangleMax.y < boxMin.y || triangleMax.z < boxMin.z) {
+			continue;
 		}
 
-		if (faceVertices.size() < 3) {
-			continue;
+		const uint32_t lane = batch.count++;
+		batchTriangles[lane] = triangle;
+		for (int coord = 0; coord < 9; ++coord) {
+			batch.coords[coord][lane] = triangles.coords[coord][triangle];
 		}
+		batch.normals[0][lane] = triangles.normals[triangle].x;
+		batch.normals[1][lane] = triangles.normals[triangle].y;
+		batch.normals[2][lane] = triangles.normals[triangle].z;
 
-		if (checkCollisionSAT(cubeVertices, faceVertices)) {
-			return GREY;
+		if (batch.count == TRIANGLE_BATCH_WIDTH) {
+			flush();
 		}
 	}
+	if (batch.count > 0) {
+		flush();
+	}
 
-	return WHITE;
+	return survivors.empty() ? WHITE : GREY;
 }
 
 bool isCollidingAABB_Sphere(const OctreeNode& cube, const Sphere& sphere)
@@ -146,7 +136,9 @@ bool isCollidingAABB_Cone(const OctreeNode& cube, const Cone& cone)
 	float distanceSq = (closestX - cone.position.pos.x) * (closestX - cone.position.pos.x) +
 					   (closestY - cone.position.pos.y) * (closestY - cone.position.pos.y);
                        
-	float effectiveRadius = cone.radius * (1 - (cube.posMax.pos.z - cone.position.pos.z) / cone.height);
+	// The cone is widest at the lowest height the cube reaches
+	float lowestZ = std::max(cube.posMin.pos.z, cone.position.pos.z);
+	float effectiveRadius = cone.radius * (1 - (lowestZ - cone.position.pos.z) / cone.height);
 	bool intersectsBase = distanceSq <= (effectiveRadius * effectiveRadius);
 	bool intersectsHeight = (cube.posMin.pos.z <= cone.position.pos.z + cone.height &&
 							 cube.posMax.pos.z >= cone.position.pos.z);
@@ -154,32 +146,275 @@ bool isCollidingAABB_Cone(const OctreeNode& cube, const Cone& cone)
 	return intersectsBase && intersectsHeight;
 }
 
-NodeCode classify(const Block& block, OctreeNode& oct) {
-	if (isCollidingAABB_Block(oct, block)) {
-		return GREY;
+// Squared distance from center to the cube corner farthest from it, over the axes flagged in mask
+float farthestCornerDistanceSq(const OctreeNode& cube, const glm::vec3& center, const glm::vec3& mask)
+{
+	float distanceSq = 0.0f;
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		float farthest = std::max(std::abs(cube.posMin.pos[axis] - center[axis]), std::abs(cube.posMax.pos[axis] - center[axis]));
+		distanceSq += mask[axis] * farthest * farthest;
 	}
-	return WHITE;
+	return distanceSq;
+}
+
+bool isContainedAABB_Sphere(const OctreeNode& cube, const Sphere& sphere)
+{
+	return farthestCornerDistanceSq(cube, sphere.position.pos, glm::vec3(1.0f, 1.0f, 1.0f)) <= sphere.radius * sphere.radius;
+}
+
+bool isContainedAABB_Block(const OctreeNode& cube, const Block& block)
+{
+	return (cube.posMin.pos.x >= block.position.pos.x - block.dimensions.x / 2 &&
+			cube.posMax.pos.x <= block.position.pos.x + block.dimensions.x / 2 &&
+			cube.posMin.pos.y >= block.position.pos.y - block.dimensions.y / 2 &&
+			cube.posMax.pos.y <= block.position.pos.y + block.dimensions.y / 2 &&
+			cube.posMin.pos.z >= block.position.pos.z - block.dimensions.z / 2 &&
+			cube.posMax.pos.z <= block.position.pos.z + block.dimensions.z / 2);
+}
+
+bool isContainedAABB_Cylinder(const OctreeNode& cube, const Cylinder& cylinder)
+{
+	bool insideHeight = (cube.posMin.pos.z >= cylinder.position.pos.z &&
+						 cube.posMax.pos.z <= cylinder.position.pos.z + cylinder.height);
+
+	return insideHeight && farthestCornerDistanceSq(cube, cylinder.position.pos, glm::vec3(1.0f, 1.0f, 0.0f)) <= cylinder.radius * cylinder.radius;
 }
 
-NodeCode classify(const Cylinder& cylinder, OctreeNode& oct) {
-	if (isCollidingAABB_Cylinder(oct, cylinder)) {
-		return GREY;
+bool isContainedAABB_Cone(const OctreeNode& cube, const Cone& cone)
+{
+	bool insideHeight = (cube.posMin.pos.z >= cone.position.pos.z &&
+						 cube.posMax.pos.z <= cone.position.pos.z + cone.height);
+	if(!insideHeight)
+	{
+		return false;
 	}
-	return WHITE;
+
+	// The cone is narrowest at the top of the cube
+	float effectiveRadius = cone.radius * (1 - (cube.posMax.pos.z - cone.position.pos.z) / cone.height);
+	return farthestCornerDistanceSq(cube, cone.position.pos, glm::vec3(1.0f, 1.0f, 0.0f)) <= effectiveRadius * effectiveRadius;
 }
 
-NodeCode classify(const Sphere& sphere, OctreeNode& oct) {
-	if (isCollidingAABB_Sphere(oct, sphere)) {
-		return GREY;
+struct BlockClassifier
+{
+	struct State {};
+
+	const Block& block;
+
+	State getRootState() const { return {}; }
+
+	NodeCode classify(const OctreeNode& oct, const State&, State&) const {
+		if (!isCollidingAABB_Block(oct, block)) {
+			return WHITE;
+		}
+		return isContainedAABB_Block(oct, block) ? BLACK : GREY;
+	}
+};
+
+struct CylinderClassifier
+{
+	struct State {};
+
+	const Cylinder& cylinder;
+
+	State getRootState() const { return {}; }
+
+	NodeCode classify(const OctreeNode& oct, const State&, State&) const {
+		if (!isCollidingAABB_Cylinder(oct, cylinder)) {
+			return WHITE;
+		}
+		return isContainedAABB_Cylinder(oct, cylinder) ? BLACK : GREY;
+	}
+};
+
+struct SphereClassifier
+{
+	struct State {};
+
+	const Sphere& sphere;
+
+	State getRootState() const { return {}; }
+
+	NodeCode classify(const OctreeNode& oct, const State&, State&) const {
+		if (!isCollidingAABB_Sphere(oct, sphere)) {
+			return WHITE;
+		}
+		return isContainedAABB_Sphere(oct, sphere) ? BLACK : GREY;
+	}
+};
+
+struct ConeClassifier
+{
+	struct State {};
+
+	const Cone& cone;
+
+	State getRootState() const { return {}; }
+
+	NodeCode classify(const OctreeNode& oct, const State&, State&) const {
+		if (!isCollidingAABB_Cone(oct, cone)) {
+			return WHITE;
+		}
+		return isContainedAABB_Cone(oct, cone) ? BLACK : GREY;
+	}
+};
+
+/*
+ * Target cells against a source tree seen through an affine map. A cell lands in the
+ * source frame as a parallelepiped; State holds the source nodes it may still overlap,
+ * so every child only tests what survived its parent, and GREY source nodes are only
+ * opened until the cell has met both colors.
+ */
+struct ResampleClassifier
+{
+	using State = std::vector<const OctreeNode*>;
+
+	const OctreeNode& source;
+	// Target frame to source frame
+	glm::mat3 linear;
+	glm::vec3 offset;
+	// Cells this wide sit at the build depth and take the source color at their center
+	float leafWidth;
+
+	State getRootState() const { return State(1, &source); }
+	NodeCode classify(const OctreeNode& oct, const State& candidates, State& survivors) const;
+	NodeCode sample(const glm::vec3& point) const;
+};
+
+NodeCode ResampleClassifier::sample(const glm::vec3& point) const
+{
+	const OctreeNode* node = &source;
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		if(point[axis] < node->posMin.pos[axis] || point[axis] >= node->posMax.pos[axis])
+		{
+			return WHITE;
+		}
+	}
+	while(node->code == GREY)
+	{
+		const glm::vec3 center = (node->posMin.pos + node->posMax.pos) * 0.5f;
+		node = node->children[(point.x >= center.x) + 2 * (point.y >= center.y) + 4 * (point.z >= center.z)];
 	}
-	return WHITE;
+	return node->code;
 }
 
-NodeCode classify(const Cone& cone, OctreeNode& oct) {
-	if (isCollidingAABB_Cone(oct, cone)) {
-		return GREY;
+NodeCode ResampleClassifier::classify(const OctreeNode& oct, const State& candidates, State& survivors) const
+{
+	survivors.clear();
+	const glm::vec3 cellCenter = (oct.posMin.pos + oct.posMax.pos) * 0.5f;
+	if(oct.posMax.pos.x - oct.posMin.pos.x < leafWidth * 1.5f)
+	{
+		return sample(linear * cellCenter + offset);
+	}
+
+	// Center and half edges of the parallelepiped, then every axis that can separate it from
+	// a box: the box's own, the parallelepiped's face normals and the cross products of edges
+	const glm::vec3 cellHalfSize = (oct.posMax.pos - oct.posMin.pos) * 0.5f;
+	const glm::vec3 center = linear * cellCenter + offset;
+	const glm::vec3 edges[3] = {linear[0] * cellHalfSize.x, linear[1] * cellHalfSize.y, linear[2] * cellHalfSize.z};
+
+	glm::vec3 axes[15];
+	float radii[15];
+	float centers[15];
+	int axisCount = 0;
+	auto addAxis = [&](const glm::vec3& axis, float scale)
+	{
+		// Parallel edges give no axis at all
+		if(glm::dot(axis, axis) <= 1e-12f * scale)
+		{
+			return;
+		}
+		axes[axisCount] = axis;
+		radii[axisCount] = std::abs(glm::dot(edges[0], axis)) + std::abs(glm::dot(edges[1], axis)) + std::abs(glm::dot(edges[2], axis));
+		centers[axisCount] = glm::dot(center, axis);
+		++axisCount;
+	};
+	for(int k = 0; k < 3; ++k)
+	{
+		glm::vec3 boxAxis(0.0f);
+		boxAxis[k] = 1.0f;
+		addAxis(boxAxis, 1.0f);
+	}
+	for(int i = 0; i < 3; ++i)
+	{
+		const glm::vec3& a = edges[(i + 1) % 3];
+		const glm::vec3& b = edges[(i + 2) % 3];
+		addAxis(glm::cross(a, b), glm::dot(a, a) * glm::dot(b, b));
+	}
+	for(int k = 0; k < 3; ++k)
+	{
+		for(int i = 0; i < 3; ++i)
+		{
+			glm::vec3 boxAxis(0.0f);
+			boxAxis[k] = 1.0f;
+			addAxis(glm::cross(boxAxis, edges[i]), glm::dot(edges[i], edges[i]));
+		}
+	}
+
+	// Touching is not overlapping, otherwise every face shared with a WHITE node would split
+	auto overlaps = [&](const OctreeNode& node)
+	{
+		const glm::vec3 boxCenter = (node.posMin.pos + node.posMax.pos) * 0.5f;
+		const glm::vec3 boxHalfSize = (node.posMax.pos - node.posMin.pos) * 0.5f;
+		for(int i = 0; i < axisCount; ++i)
+		{
+			const glm::vec3& axis = axes[i];
+			const float boxRadius = boxHalfSize.x * std::abs(axis.x) + boxHalfSize.y * std::abs(axis.y) + boxHalfSize.z * std::abs(axis.z);
+			if(std::abs(centers[i] - glm::dot(boxCenter, axis)) >= (radii[i] + boxRadius) * (1.0f - 1e-5f))
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+
+	// Whatever sticks out of the source box is empty
+	const glm::vec3 reach = glm::abs(edges[0]) + glm::abs(edges[1]) + glm::abs(edges[2]);
+	bool bWhite = false;
+	bool bBlack = false;
+	for(int k = 0; k < 3; ++k)
+	{
+		bWhite = bWhite || center[k] - reach[k] < source.posMin.pos[k] || center[k] + reach[k] > source.posMax.pos[k];
+	}
+
+	for(const OctreeNode* node : candidates)
+	{
+		if(overlaps(*node))
+		{
+			survivors.push_back(node);
+		}
+	}
+
+	// survivors[0, i) are leaves already counted; a GREY node gives way to its overlapping children
+	size_t i = 0;
+	while(i < survivors.size() && !(bWhite && bBlack))
+	{
+		const OctreeNode* node = survivors[i];
+		if(node->code != GREY)
+		{
+			bBlack = bBlack || node->code == BLACK;
+			bWhite = bWhite || node->code == WHITE;
+			++i;
+			continue;
+		}
+
+		survivors[i] = survivors.back();
+		survivors.pop_back();
+		for(const OctreeNode* child : node->children)
+		{
+			if(overlaps(*child))
+			{
+				survivors.push_back(child);
+			}
+		}
+	}
+
+	if(!bBlack)
+	{
+		return WHITE;
 	}
-	return WHITE;
+	return bWhite ? GREY : BLACK;
 }
 
 char codeToChar(NodeCode code)
@@ -191,114 +426,249 @@ char codeToChar(NodeCode code)
 	return 'G';
 }
 
+void appendCube(const glm::vec3& posMin, const glm::vec3& posMax, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex)
+{
+	glm::vec3 cubeVertices[] = {
+		{posMin.x, posMin.y, posMin.z},
+		{posMax.x, posMin.y, posMin.z},
+		{posMax.x, posMax.y, posMin.z},
+		{posMin.x, posMax.y, posMin.z},
+		{posMin.x, posMin.y, posMax.z},
+		{posMax.x, posMin.y, posMax.z},
+		{posMax.x, posMax.y, posMax.z},
+		{posMin.x, posMax.y, posMax.z}
+	};
+
+	for (const auto& pos : cubeVertices) {
+		glm::vec3 localPos = (pos - posMin) / (posMax - posMin);
+		glm::vec3 color = localPos;
+		vertices.push_back({pos, color});
+	}
+
+	uint32_t cubeIndices[] = {
+		0, 1, 2,  0, 2, 3,
+		4, 5, 6,  4, 6, 7,
+		0, 1, 5,  0, 5, 4,
+		2, 3, 7,  2, 7, 6,
+		0, 3, 7,  0, 7, 4,
+		1, 2, 6,  1, 6, 5 
+	};
+
+	for (uint32_t i = 0; i < 36; ++i) {
+		indices.push_back(currentIndex + cubeIndices[i]);
+	}
+
+	currentIndex += 8;
+}
+
 void populateFromOctree(OctreeNode* node, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex)
 {
 	if (!node || node->code == WHITE) return;
     
 	if(node->code == BLACK)
 	{
-		glm::vec3 cubeVertices[] = {
-			{node->posMin.pos.x, node->posMin.pos.y, node->posMin.pos.z},
-			{node->posMax.pos.x, node->posMin.pos.y, node->posMin.pos.z},
-			{node->posMax.pos.x, node->posMax.pos.y, node->posMin.pos.z},
-			{node->posMin.pos.x, node->posMax.pos.y, node->posMin.pos.z},
-			{node->posMin.pos.x, node->posMin.pos.y, node->posMax.pos.z},
-			{node->posMax.pos.x, node->posMin.pos.y, node->posMax.pos.z},
-			{node->posMax.pos.x, node->posMax.pos.y, node->posMax.pos.z},
-			{node->posMin.pos.x, node->posMax.pos.y, node->posMax.pos.z}
-		};
+		appendCube(node->posMin.pos, node->posMax.pos, vertices, indices, currentIndex);
+	}
 
-		for (const auto& pos : cubeVertices) {
-			glm::vec3 localPos = (pos - node->posMin.pos) / (node->posMax.pos - node->posMin.pos);
-			glm::vec3 color = localPos;
-			vertices.push_back({pos, color});
+	else
+	{
+		for (OctreeNode* child : node->children) {
+			populateFromOctree(child, vertices, indices, currentIndex);
 		}
+	}
+}
 
-		uint32_t cubeIndices[] = {
-			0, 1, 2,  0, 2, 3,
-			4, 5, 6,  4, 6, 7,
-			0, 1, 5,  0, 5, 4,
-			2, 3, 7,  2, 7, 6,
-			0, 3, 7,  0, 7, 4,
-			1, 2, 6,  1, 6, 5 
-		};
+void decodeMortonKey(uint64_t key, uint8_t maxDepth, uint32_t& x, uint32_t& y, uint32_t& z)
+{
+	x = y = z = 0;
+	for(int shift = 3 * (maxDepth - 1); shift >= 0; shift -= 3)
+	{
+		const uint32_t slot = static_cast<uint32_t>(key >> shift) & 7u;
+		x = (x << 1) | (slot & 1u);
+		y = (y << 1) | ((slot >> 1) & 1u);
+		z = (z << 1) | (slot >> 2);
+	}
+}
 
-		for (uint32_t i = 0; i < 36; ++i) {
-			indices.push_back(currentIndex + cubeIndices[i]);
-		}
+void getLinearLeafBounds(const LinearOctree& oct, size_t leaf, glm::vec3& posMin, glm::vec3& posMax)
+{
+	const glm::vec3 cellSize = (oct.posMax - oct.posMin) / static_cast<float>(1u << oct.maxDepth);
+	uint32_t x, y, z;
+	decodeMortonKey(oct.keys[leaf], oct.maxDepth, x, y, z);
+	posMin = oct.posMin + glm::vec3(x, y, z) * cellSize;
+	posMax = posMin + cellSize * static_cast<float>(1u << (oct.maxDepth - oct.levels[leaf]));
+}
 
-		currentIndex += 8;
+void populateFromOctree(const LinearOctree& oct, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex)
+{
+	vertices.reserve(vertices.size() + oct.keys.size() * 8);
+	indices.reserve(indices.size() + oct.keys.size() * 36);
+	for(size_t i = 0; i < oct.keys.size(); ++i)
+	{
+		glm::vec3 posMin, posMax;
+		getLinearLeafBounds(oct, i, posMin, posMax);
+		appendCube(posMin, posMax, vertices, indices, currentIndex);
 	}
+}
 
-	else
+void translateOctree(Octree& tree, const glm::vec3& offset)
+{
+	tree.translation += offset;
+}
+
+void scaleOctree(Octree& tree, float factor)
+{
+	if(!(factor > 0.f))
 	{
-		for (OctreeNode* child : node->children) {
-			populateFromOctree(child, vertices, indices, currentIndex);
+		throw std::invalid_argument("octree scale factor must be positive");
+	}
+	tree.scale *= factor;
+	tree.translation *= factor;
+}
+
+glm::vec3 getWorldPosition(const Octree& tree, const glm::vec3& local)
+{
+	return local * tree.scale + tree.translation;
+}
+
+void getOctreeBounds(const Octree& tree, glm::vec3& posMin, glm::vec3& posMax)
+{
+	posMin = getWorldPosition(tree, tree.root->posMin.pos);
+	posMax = getWorldPosition(tree, tree.root->posMax.pos);
+}
+
+void populateFromOctree(const OctreeNode& node, const Octree& tree, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex)
+{
+	if(node.code == BLACK)
+	{
+		appendCube(getWorldPosition(tree, node.posMin.pos), getWorldPosition(tree, node.posMax.pos), vertices, indices, currentIndex);
+	}
+	else if(node.code == GREY)
+	{
+		for(const OctreeNode* child : node.children)
+		{
+			populateFromOctree(*child, tree, vertices, indices, currentIndex);
 		}
 	}
 }
 
 
-void subdivide(OctreeNode& oct)
+OctreeNode* OctreeArena::allocateChildren()
+{
+	if(currentChunk < chunks.size() && usedBlocks == chunks[currentChunk].blocks)
+	{
+		++currentChunk;
+		usedBlocks = 0;
+	}
+
+	if(currentChunk == chunks.size())
+	{
+		const size_t blocks = chunks.empty() ? FIRST_CHUNK_BLOCKS : std::min(chunks.back().blocks * 2, MAX_CHUNK_BLOCKS);
+		chunks.push_back({std::make_unique<OctreeNode[]>(blocks * 8), blocks});
+	}
+
+	OctreeNode* block = &chunks[currentChunk].nodes[usedBlocks * 8];
+	++usedBlocks;
+	nodeCount += 8;
+
+	// Chunks are reused after reset(), so hand them out clean
+	std::fill(block, block + 8, OctreeNode{});
+	return block;
+}
+
+void OctreeArena::reset()
+{
+	for(Chunk& chunk : adoptedChunks)
+	{
+		chunks.push_back(std::move(chunk));
+	}
+	adoptedChunks.clear();
+
+	currentChunk = 0;
+	usedBlocks = 0;
+	nodeCount = 0;
+}
+
+OctreeArena::Mark OctreeArena::getMark() const
+{
+	return {currentChunk, usedBlocks, nodeCount};
+}
+
+void OctreeArena::rewind(const Mark& mark)
+{
+	currentChunk = mark.chunk;
+	usedBlocks = mark.usedBlocks;
+	nodeCount = mark.nodeCount;
+}
+
+void OctreeArena::adopt(OctreeArena&& other)
+{
+	for(Chunk& chunk : other.chunks)
+	{
+		adoptedChunks.push_back(std::move(chunk));
+	}
+	for(Chunk& chunk : other.adoptedChunks)
+	{
+		adoptedChunks.push_back(std::move(chunk));
+	}
+	nodeCount += other.nodeCount;
+
+	other.chunks.clear();
+	other.adoptedChunks.clear();
+	other.reset();
+}
+
+void OctreeArena::release()
+{
+	chunks.clear();
+	adoptedChunks.clear();
+	reset();
+}
+
+void subdivide(OctreeNode& oct, OctreeArena& arena)
 {
 	glm::vec3 halfSize = (oct.posMax.pos - oct.posMin.pos) / 2.0f;
+	OctreeNode* block = arena.allocateChildren();
 	for (int i = 0; i < 8; ++i) {
-		oct.children[i] = new OctreeNode();
+		oct.children[i] = &block[i];
 		oct.children[i]->posMin.pos = oct.posMin.pos + glm::vec3(i % 2, (i / 2) % 2, i / 4) * halfSize;
 		oct.children[i]->posMax.pos = oct.children[i]->posMin.pos + halfSize;
 	}
 }
 
-void buildTree(MModel& model, OctreeNode& oct, int depth, std::string& code)
+void updateAggregates(OctreeNode& oct)
 {
-	oct.code = classify(model, oct); //returns white, grey;
-	if(oct.code == GREY)
+	oct.volume = 0.f;
+	oct.blackCount = 0;
+	oct.greyCount = 0;
+	if(oct.code == BLACK)
 	{
-		if(depth == 0)
-		{
-			oct.code = BLACK;
-			code += 'B';
-		}
-		else
-		{
-			subdivide(oct);
-			bool bBlackBranch = true;
-			
-			code += '(';
-			for(OctreeNode* childrenNode : oct.children)
-			{
-				buildTree(model, *childrenNode, depth - 1, code);
-				if(childrenNode->code != BLACK)
-				{
-					bBlackBranch = false;
-				}
-			}
-			if(bBlackBranch)
-			{
-				for(OctreeNode* childrenNode : oct.children)
-				{
-					code.pop_back();
-				}
-				code.pop_back();
-				oct.code = BLACK;
-			}
-			else
-			{
-				code += ')';
-			}
-		}
+		glm::vec3 dimensoes = oct.posMax.pos - oct.posMin.pos;
+		oct.volume = (dimensoes.x < 0 || dimensoes.y < 0 || dimensoes.z < 0) ? -99999.0f : dimensoes.x * dimensoes.y * dimensoes.z;
+		oct.blackCount = 1;
 	}
-
-	if(oct.code == WHITE)
+	else if(oct.code == GREY)
 	{
-		code += 'W';
+		oct.greyCount = 1;
+		for(const OctreeNode* child : oct.children)
+		{
+			oct.volume += child->volume;
+			oct.blackCount += child->blackCount;
+			oct.greyCount += child->greyCount;
+		}
 	}
 }
 
-void buildTree(Sphere& model, OctreeNode& oct, int depth, std::string& code)
+// states[depth + 1] holds the parent's state, this node writes its own to states[depth]
+template<typename Classifier>
+void buildSubtree(const Classifier& classifier, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, typename Classifier::State* states)
 {
-	oct.code = classify(model, oct); //returns white, grey;
-	if(oct.code == GREY)
+	oct.code = classifier.classify(oct, states[depth + 1], states[depth]); //returns white, black, grey;
+	if(oct.code == BLACK)
+	{
+		code += 'B';
+	}
+	else if(oct.code == GREY)
 	{
 		if(depth == 0)
 		{
@@ -307,13 +677,14 @@ void buildTree(Sphere& model, OctreeNode& oct, int depth, std::string& code)
 		}
 		else
 		{
-			subdivide(oct);
+			const OctreeArena::Mark mark = arena.getMark();
+			subdivide(oct, arena);
 			bool bBlackBranch = true;
 			
 			code += '(';
 			for(OctreeNode* childrenNode : oct.children)
 			{
-				buildTree(model, *childrenNode, depth - 1, code);
+				buildSubtree(classifier, *childrenNode, arena, depth - 1, code, states);
 				if(childrenNode->code != BLACK)
 				{
 					bBlackBranch = false;
@@ -321,11 +692,11 @@ void buildTree(Sphere& model, OctreeNode& oct, int depth, std::string& code)
 			}
 			if(bBlackBranch)
 			{
-				for(OctreeNode* childrenNode : oct.children)
-				{
-					code.pop_back();
-				}
-				code.pop_back();
+				// '(' plus eight 'B's collapse into one 'B', and the whole subtree goes back to the arena
+				code.resize(code.size() - 9);
+				code += 'B';
+				oct.children = {};
+				arena.rewind(mark);
 				oct.code = BLACK;
 			}
 			else
@@ -339,148 +710,289 @@ void buildTree(Sphere& model, OctreeNode& oct, int depth, std::string& code)
 	{
 		code += 'W';
 	}
+	updateAggregates(oct);
 }
 
-void buildTree(Block& model, OctreeNode& oct, int depth, std::string& code)
+template<typename Classifier>
+void buildTree(const Classifier& classifier, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, const typename Classifier::State& parentState)
 {
-	oct.code = classify(model, oct); //returns white, grey;
-	if(oct.code == GREY)
+	// One state per level, reused by every node on it
+	std::vector<typename Classifier::State> states(depth + 2);
+	states[depth + 1] = parentState;
+	buildSubtree(classifier, oct, arena, depth, code, states.data());
+}
+
+template<typename Classifier>
+void buildTreeParallel(const Classifier& classifier, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth, const typename Classifier::State& parentState)
+{
+	if(!scheduler || parallelDepth <= 0 || depth == 0)
 	{
-		if(depth == 0)
+		buildTree(classifier, oct, arena, depth, code, parentState);
+		return;
+	}
+
+	typename Classifier::State nodeState;
+	oct.code = classifier.classify(oct, parentState, nodeState);
+	if(oct.code == WHITE || oct.code == BLACK)
+	{
+		code += codeToChar(oct.code);
+		updateAggregates(oct);
+		return;
+	}
+
+	const OctreeArena::Mark mark = arena.getMark();
+	subdivide(oct, arena);
+
+	// Every subtree writes its own code and owns its own nodes until they are stitched back in order
+	std::array<std::string, 8> childCodes;
+	std::array<OctreeArena, 8> childArenas;
+	MTaskScheduler::TaskGroup group;
+	for(int i = 0; i < 8; ++i)
+	{
+		scheduler->run(group, [&, i]
 		{
-			oct.code = BLACK;
-			code += 'B';
-		}
-		else
-		{
-			subdivide(oct);
-			bool bBlackBranch = true;
-			
-			code += '(';
-			for(OctreeNode* childrenNode : oct.children)
-			{
-				buildTree(model, *childrenNode, depth - 1, code);
-				if(childrenNode->code != BLACK)
-				{
-					bBlackBranch = false;
-				}
-			}
-			if(bBlackBranch)
-			{
-				for(OctreeNode* childrenNode : oct.children)
-				{
-					//code.pop_back();
-				}
-				//code.pop_back();
-				oct.code = BLACK;
-			}
-			else
-			{
-				code += ')';
-			}
-		}
+			buildTreeParallel(classifier, *oct.children[i], childArenas[i], depth - 1, childCodes[i], scheduler, parallelDepth - 1, nodeState);
+		});
 	}
+	scheduler->wait(group);
 
-	if(oct.code == WHITE)
+	const bool bBlackBranch = std::all_of(oct.children.begin(), oct.children.end(), [](const OctreeNode* child) { return child->code == BLACK; });
+	if(bBlackBranch)
 	{
-		code += 'W';
+		code += 'B';
+		oct.children = {};
+		arena.rewind(mark);
+		oct.code = BLACK;
+		updateAggregates(oct);
+		return;
+	}
+
+	code += '(';
+	for(int i = 0; i < 8; ++i)
+	{
+		code += childCodes[i];
+		arena.adopt(std::move(childArenas[i]));
+	}
+	code += ')';
+	updateAggregates(oct);
+}
+
+template<typename Classifier>
+void buildTreeParallel(const Classifier& classifier, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildTreeParallel(classifier, oct, arena, depth, code, scheduler, parallelDepth, classifier.getRootState());
+}
+
+void buildTree(MModel& model, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildTreeParallel(MeshClassifier(model), oct, arena, depth, code, scheduler, parallelDepth);
+}
+
+void buildTree(Sphere& model, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildTreeParallel(SphereClassifier{model}, oct, arena, depth, code, scheduler, parallelDepth);
+}
+
+void buildTree(Block& model, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildTreeParallel(BlockClassifier{model}, oct, arena, depth, code, scheduler, parallelDepth);
+}
+
+void buildTree(Cylinder& model, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildTreeParallel(CylinderClassifier{model}, oct, arena, depth, code, scheduler, parallelDepth);
+}
+
+void buildTree(Cone& model, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildTreeParallel(ConeClassifier{model}, oct, arena, depth, code, scheduler, parallelDepth);
+}
+
+void buildTreeFromResampling(const OctreeNode& source, const glm::mat4& transform, OctreeNode& newTree, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	const glm::mat3 linear(transform);
+	const float determinant = glm::determinant(linear);
+	if(!std::isfinite(determinant) || std::abs(determinant) < 1e-12f)
+	{
+		throw std::invalid_argument("resampling transform must be invertible");
 	}
+
+	ResampleClassifier classifier{source, glm::inverse(linear), glm::vec3(0.0f), 0.0f};
+	classifier.offset = -(classifier.linear * glm::vec3(transform[3]));
+	classifier.leafWidth = std::ldexp(newTree.posMax.pos.x - newTree.posMin.pos.x, -depth);
+	buildTreeParallel(classifier, newTree, arena, depth, code, scheduler, parallelDepth);
+}
+
+OctreeNode buildResampledBoundingBox(const OctreeNode& source, const glm::mat4& transform)
+{
+	const glm::mat3 linear(transform);
+	const glm::vec3 center = linear * ((source.posMin.pos + source.posMax.pos) * 0.5f) + glm::vec3(transform[3]);
+	const glm::vec3 halfSize = (source.posMax.pos - source.posMin.pos) * 0.5f;
+	const glm::vec3 reach = glm::abs(linear[0] * halfSize.x) + glm::abs(linear[1] * halfSize.y) + glm::abs(linear[2] * halfSize.z);
+	const float halfSide = std::max(reach.x, std::max(reach.y, reach.z));
+
+	return OctreeNode{{center - glm::vec3(halfSide)}, {center + glm::vec3(halfSide)}};
 }
 
-void buildTree(Cylinder& model, OctreeNode& oct, int depth, std::string& code)
+// Same state layout as buildSubtree, indexed by the levels left below this node
+template<typename Classifier>
+NodeCode buildLinearSubtree(const Classifier& classifier, LinearOctree& oct, const glm::vec3& posMin, const glm::vec3& posMax, uint64_t key, uint8_t level, std::string& code, typename Classifier::State* states)
 {
-	oct.code = classify(model, oct); //returns white, grey;
-	if(oct.code == GREY)
+	const int depth = oct.maxDepth - level;
+	OctreeNode bounds{};
+	bounds.posMin.pos = posMin;
+	bounds.posMax.pos = posMax;
+	const NodeCode nodeCode = classifier.classify(bounds, states[depth + 1], states[depth]);
+	if(nodeCode == WHITE)
 	{
-		if(depth == 0)
-		{
-			oct.code = BLACK;
-			code += 'B';
-		}
-		else
+		code += 'W';
+		return WHITE;
+	}
+
+	if(nodeCode == BLACK || level == oct.maxDepth)
+	{
+		oct.keys.push_back(key);
+		oct.levels.push_back(level);
+		code += 'B';
+		return BLACK;
+	}
+
+	const glm::vec3 halfSize = (posMax - posMin) / 2.0f;
+	const int childShift = 3 * (oct.maxDepth - level - 1);
+	bool bBlackBranch = true;
+
+	code += '(';
+	for(int i = 0; i < 8; ++i)
+	{
+		const glm::vec3 childMin = posMin + glm::vec3(i % 2, (i / 2) % 2, i / 4) * halfSize;
+		if(buildLinearSubtree(classifier, oct, childMin, childMin + halfSize, key | (static_cast<uint64_t>(i) << childShift), level + 1, code, states) != BLACK)
 		{
-			subdivide(oct);
-			bool bBlackBranch = true;
-			
-			code += '(';
-			for(OctreeNode* childrenNode : oct.children)
-			{
-				buildTree(model, *childrenNode, depth - 1, code);
-				if(childrenNode->code != BLACK)
-				{
-					bBlackBranch = false;
-				}
-			}
-			if(bBlackBranch)
-			{
-				for(OctreeNode* childrenNode : oct.children)
-				{
-					//code.pop_back();
-				}
-				//code.pop_back();
-				oct.code = BLACK;
-			}
-			else
-			{
-				code += ')';
-			}
+			bBlackBranch = false;
 		}
 	}
 
-	if(oct.code == WHITE)
+	if(bBlackBranch)
 	{
-		code += 'W';
+		code.resize(code.size() - 9);
+		code += 'B';
+		oct.keys.resize(oct.keys.size() - 8);
+		oct.levels.resize(oct.levels.size() - 8);
+		oct.keys.push_back(key);
+		oct.levels.push_back(level);
+		return BLACK;
 	}
+
+	code += ')';
+	return GREY;
 }
 
-void buildTree(Cone& model, OctreeNode& oct, int depth, std::string& code)
+template<typename Classifier>
+NodeCode buildLinearTreeParallel(const Classifier& classifier, LinearOctree& oct, const glm::vec3& posMin, const glm::vec3& posMax, uint64_t key, uint8_t level, std::string& code, MTaskScheduler* scheduler, int parallelDepth, const typename Classifier::State& parentState)
 {
-	oct.code = classify(model, oct); //returns white, grey;
-	if(oct.code == GREY)
+	if(!scheduler || parallelDepth <= 0 || level == oct.maxDepth)
 	{
-		if(depth == 0)
-		{
-			oct.code = BLACK;
-			code += 'B';
-		}
-		else
-		{
-			subdivide(oct);
-			bool bBlackBranch = true;
-			
-			code += '(';
-			for(OctreeNode* childrenNode : oct.children)
-			{
-				buildTree(model, *childrenNode, depth - 1, code);
-				if(childrenNode->code != BLACK)
-				{
-					bBlackBranch = false;
-				}
-			}
-			if(bBlackBranch)
-			{
-				for(OctreeNode* childrenNode : oct.children)
-				{
-					//code.pop_back();
-				}
-				//code.pop_back();
-				oct.code = BLACK;
-			}
-			else
-			{
-				code += ')';
-			}
-		}
+		std::vector<typename Classifier::State> states(oct.maxDepth - level + 2);
+		states.back() = parentState;
+		return buildLinearSubtree(classifier, oct, posMin, posMax, key, level, code, states.data());
 	}
 
-	if(oct.code == WHITE)
+	OctreeNode bounds{};
+	bounds.posMin.pos = posMin;
+	bounds.posMax.pos = posMax;
+	typename Classifier::State nodeState;
+	const NodeCode nodeCode = classifier.classify(bounds, parentState, nodeState);
+	if(nodeCode == WHITE)
 	{
 		code += 'W';
+		return WHITE;
+	}
+	if(nodeCode == BLACK)
+	{
+		oct.keys.push_back(key);
+		oct.levels.push_back(level);
+		code += 'B';
+		return BLACK;
+	}
+
+	const glm::vec3 halfSize = (posMax - posMin) / 2.0f;
+	const int childShift = 3 * (oct.maxDepth - level - 1);
+
+	// Keys are in preorder, so the fragments of the eight subtrees just concatenate
+	std::array<LinearOctree, 8> fragments;
+	std::array<std::string, 8> childCodes;
+	std::array<NodeCode, 8> childResults;
+	MTaskScheduler::TaskGroup group;
+	for(int i = 0; i < 8; ++i)
+	{
+		fragments[i].maxDepth = oct.maxDepth;
+		scheduler->run(group, [&, i]
+		{
+			const glm::vec3 childMin = posMin + glm::vec3(i % 2, (i / 2) % 2, i / 4) * halfSize;
+			childResults[i] = buildLinearTreeParallel(classifier, fragments[i], childMin, childMin + halfSize, key | (static_cast<uint64_t>(i) << childShift), level + 1, childCodes[i], scheduler, parallelDepth - 1, nodeState);
+		});
+	}
+	scheduler->wait(group);
+
+	if(std::all_of(childResults.begin(), childResults.end(), [](NodeCode result) { return result == BLACK; }))
+	{
+		oct.keys.push_back(key);
+		oct.levels.push_back(level);
+		code += 'B';
+		return BLACK;
+	}
+
+	code += '(';
+	for(int i = 0; i < 8; ++i)
+	{
+		code += childCodes[i];
+		oct.keys.insert(oct.keys.end(), fragments[i].keys.begin(), fragments[i].keys.end());
+		oct.levels.insert(oct.levels.end(), fragments[i].levels.begin(), fragments[i].levels.end());
+	}
+	code += ')';
+	return GREY;
+}
+
+template<typename Classifier>
+void buildLinearTree(const Classifier& classifier, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	if(depth < 0 || depth > LINEAR_OCTREE_MAX_DEPTH)
+	{
+		throw std::invalid_argument("linear octree depth must be in [0, 21]");
 	}
+
+	oct.maxDepth = static_cast<uint8_t>(depth);
+	oct.keys.clear();
+	oct.levels.clear();
+	buildLinearTreeParallel(classifier, oct, oct.posMin, oct.posMax, 0, 0, code, scheduler, parallelDepth, classifier.getRootState());
+}
+
+void buildTree(MModel& model, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildLinearTree(MeshClassifier(model), oct, depth, code, scheduler, parallelDepth);
+}
+
+void buildTree(Sphere& model, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildLinearTree(SphereClassifier{model}, oct, depth, code, scheduler, parallelDepth);
+}
+
+void buildTree(Block& model, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildLinearTree(BlockClassifier{model}, oct, depth, code, scheduler, parallelDepth);
+}
+
+void buildTree(Cylinder& model, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildLinearTree(CylinderClassifier{model}, oct, depth, code, scheduler, parallelDepth);
+}
+
+void buildTree(Cone& model, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildLinearTree(ConeClassifier{model}, oct, depth, code, scheduler, parallelDepth);
 }
 
 
-void readCodeAndPopulateTree(OctreeNode& oct, std::string::iterator& code, std::string::iterator& end)
+void readCodeAndPopulateTree(OctreeNode& oct, OctreeArena& arena, std::string::iterator& code, std::string::iterator& end)
 {
 	if(code == end)
 		return;
@@ -500,18 +1012,18 @@ void readCodeAndPopulateTree(OctreeNode& oct, std::string::iterator& code, std::
 	else if(*code == '(')
 	{
 		oct.code = GREY;
-		subdivide(oct);
+		subdivide(oct, arena);
 		for(OctreeNode* childrenNode : oct.children)
 		{
-			readCodeAndPopulateTree(*childrenNode, code, end);
+			readCodeAndPopulateTree(*childrenNode, arena, code, end);
 		}
 		
 		++code;
 	}
-	
+	updateAggregates(oct);
 }
 
-OctreeNode buildTreeFromCode(std::string& code, glm::vec3 posMin, glm::vec3 posMax)
+OctreeNode buildTreeFromCode(std::string& code, OctreeArena& arena, glm::vec3 posMin, glm::vec3 posMax)
 {
 	OctreeNode root;
 	root.posMin.pos = posMin;
@@ -532,18 +1044,81 @@ OctreeNode buildTreeFromCode(std::string& code, glm::vec3 posMin, glm::vec3 posM
 	else if(*codeIterator == '(')
 	{
 		root.code = GREY;
-		subdivide(root);
+		subdivide(root, arena);
 		for(OctreeNode* childrenNode : root.children)
 		{
-			readCodeAndPopulateTree(*childrenNode, codeIterator, end);
+			readCodeAndPopulateTree(*childrenNode, arena, codeIterator, end);
 		}
 		
 		++codeIterator;
 	}
 
+	updateAggregates(root);
 	return root;
 }
 
+LinearOctree buildLinearTreeFromCode(const std::string& code, glm::vec3 posMin, glm::vec3 posMax)
+{
+	LinearOctree oct;
+	oct.posMin = posMin;
+	oct.posMax = posMax;
+
+	int nesting = 0;
+	int maxNesting = 0;
+	for(const char c : code)
+	{
+		if(c == '(')
+		{
+			maxNesting = std::max(maxNesting, ++nesting);
+		}
+		else if(c == ')')
+		{
+			--nesting;
+		}
+	}
+	if(maxNesting > LINEAR_OCTREE_MAX_DEPTH)
+	{
+		throw std::invalid_argument("octree code is too deep for a linear octree");
+	}
+	oct.maxDepth = static_cast<uint8_t>(maxNesting);
+
+	// One entry per open GREY node: its key and how many children were already read
+	std::vector<std::pair<uint64_t, int>> stack;
+	uint64_t key = 0;
+	for(const char c : code)
+	{
+		if(c != 'B' && c != 'W' && c != '(')
+		{
+			continue;
+		}
+
+		const uint8_t level = static_cast<uint8_t>(stack.size());
+		if(!stack.empty())
+		{
+			key = stack.back().first | (static_cast<uint64_t>(stack.back().second) << (3 * (oct.maxDepth - level)));
+		}
+
+		if(c == '(')
+		{
+			stack.emplace_back(key, 0);
+			continue;
+		}
+
+		if(c == 'B')
+		{
+			oct.keys.push_back(key);
+			oct.levels.push_back(level);
+		}
+
+		while(!stack.empty() && ++stack.back().second == 8)
+		{
+			stack.pop_back();
+		}
+	}
+
+	return oct;
+}
+
 OctreeNode createNodeForSphere(const Sphere& sphere) {
 	OctreeNode node{};
 	node.posMin.pos = {sphere.position.pos.x - sphere.radius, 
@@ -589,6 +1164,14 @@ OctreeNode createNodeForCone(const Cone& cone) {
 	return node;
 }
 
+LinearOctree createLinearOctree(const OctreeNode& root)
+{
+	LinearOctree oct{};
+	oct.posMin = root.posMin.pos;
+	oct.posMax = root.posMax.pos;
+	return oct;
+}
+
 OctreeNode buildInitialBoundingBox(MModel& m)
 {
 	Vertex maxPos{};
@@ -650,50 +1233,30 @@ OctreeNode buildInitialBoundingBox(MModel& m)
 	return OctreeNode{finalPosMin,finalPosMax};
 }
 
-void boolOperationOneIsLeaf(const OctreeNode& rootA, const OctreeNode& rootB, OctreeNode& newTree, const Operation& operation, std::string& code)
+float getOctreeVolume(OctreeNode* node)
 {
-	if (rootA.code == BLACK) {
-		if (operation == INTERSECTION) {
-			newTree.code = rootB.code;
-			code += 'G';
-		}
-		else{
-			newTree.code = BLACK;
-			code += 'B';
-		}
-	}
-	else {
-		if (operation == INTERSECTION) {
-			newTree.code =  WHITE;
-			code += 'W';
-		}
-		else{
-			newTree = rootB;
-			code += 'G';
-		}
-	}
+	return node ? node->volume : 0.f;
 }
 
-float getOctreeVolume(OctreeNode* node)
+float getOctreeVolume(const Octree& tree)
 {
-	float volume = 0.f;
-	if (!node || node->code == WHITE) return volume;
-    
-	if(node->code == BLACK)
-	{
-		glm::vec3 dimensoes = node->posMax.pos - node->posMin.pos;
+	return getOctreeVolume(tree.root) * tree.scale * tree.scale * tree.scale;
+}
 
-		if (dimensoes.x < 0 || dimensoes.y < 0 || dimensoes.z < 0) {
-			return -99999.0f;
-		}
-		
-		return dimensoes.x * dimensoes.y * dimensoes.z;
+float getOctreeVolume(const LinearOctree& oct)
+{
+	std::array<uint64_t, LINEAR_OCTREE_MAX_DEPTH + 1> leavesPerLevel{};
+	for(const uint8_t level : oct.levels)
+	{
+		++leavesPerLevel[level];
 	}
-	else
+
+	const glm::vec3 dimensoes = oct.posMax - oct.posMin;
+	float volume = 0.f;
+	for(uint8_t level = 0; level <= oct.maxDepth; ++level)
 	{
-		for (OctreeNode* child : node->children) {
-			volume += getOctreeVolume(child);
-		}
+		const float cellScale = 1.0f / static_cast<float>(1u << level);
+		volume += static_cast<float>(leavesPerLevel[level]) * dimensoes.x * dimensoes.y * dimensoes.z * cellScale * cellScale * cellScale;
 	}
 
 	return volume;
@@ -715,142 +1278,1194 @@ void getOctreeBlackNodes(OctreeNode* node, std::vector<OctreeNode*>& blackNodes)
 	}
 }
 
-float getOctreeArea(OctreeNode& node)
+void paintOctreeRegion(OctreeNode& root, const std::vector<uint8_t>& path, NodeCode code, OctreeArena& arena)
 {
-	std::vector<OctreeNode*> blackNodes{};
-	getOctreeBlackNodes(&node,blackNodes);
-
-	const std::vector<glm::vec3> directions = {
-		glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), // x-axis
-		glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), // y-axis
-		glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)  // z-axis
-	};
-
-	float total_surface_area = 0.0;
-
-	for (const auto& bNode : blackNodes)
+	if(code == GREY)
 	{
-		glm::vec3 w = bNode->posMax.pos - bNode->posMin.pos;
-		const float faceArea = w.x * w.x;
+		throw std::invalid_argument("an octree region can only be painted BLACK or WHITE");
+	}
 
-		for (const auto& dir : directions) {
-			glm::vec3 neighborPosition = node.posMin.pos + dir * faceArea;
+	std::vector<OctreeNode*> ancestors;
+	ancestors.reserve(path.size());
+	OctreeNode* node = &root;
+	for(const uint8_t slot : path)
+	{
+		if(slot > 7)
+		{
+			throw std::invalid_argument("octree child slots go from 0 to 7");
+		}
 
-			bool neighborFound = false;
-			for (const auto& otherBNode : blackNodes) {
-				glm::vec3 otherW = otherBNode->posMax.pos - otherBNode->posMin.pos;
-				if (neighborPosition == otherBNode->posMin.pos && w == otherW) {
-					neighborFound = true;
-					break;
-				}
+		// A leaf on the way becomes eight leaves of its color
+		if(node->code != GREY)
+		{
+			const NodeCode leafCode = node->code;
+			subdivide(*node, arena);
+			for(OctreeNode* child : node->children)
+			{
+				child->code = leafCode;
+				updateAggregates(*child);
 			}
+			node->code = GREY;
+		}
 
-			if (!neighborFound) {
-				total_surface_area += faceArea;
-			}
+		ancestors.push_back(node);
+		node = node->children[slot];
+	}
+
+	node->code = code;
+	node->children = {};
+	updateAggregates(*node);
+
+	for(auto it = ancestors.rbegin(); it != ancestors.rend(); ++it)
+	{
+		OctreeNode& ancestor = **it;
+		const NodeCode firstCode = ancestor.children[0]->code;
+		if(firstCode != GREY && std::all_of(ancestor.children.begin(), ancestor.children.end(), [firstCode](const OctreeNode* child) { return child->code == firstCode; }))
+		{
+			ancestor.code = firstCode;
+			ancestor.children = {};
 		}
+		updateAggregates(ancestor);
 	}
+}
 
-	return total_surface_area;
+// Face of node facing along axis
+double getFaceArea(const OctreeNode& node, int axis)
+{
+	const glm::vec3 w = node.posMax.pos - node.posMin.pos;
+	return double(w[(axis + 1) % 3]) * w[(axis + 2) % 3];
 }
 
-void buildTreeFromBooleanOperation(const OctreeNode& rootA, const OctreeNode& rootB, OctreeNode& newTree, const Operation& operation, std::string& code, bool bAisNull, bool bBisNull)
+/*
+ * Area where BLACK leaves under low touch BLACK leaves under high, low being the
+ * neighbor of high on the min side along axis. Only the children lining the shared
+ * face are paired, and a leaf stands in for its own children, so leaves of different
+ * sizes meet over the smaller face.
+ */
+double getSharedBlackArea(const OctreeNode& low, const OctreeNode& high, int axis)
 {
-	if(bAisNull)
+	if(low.code == WHITE || high.code == WHITE)
 	{
-		if(rootB.code == GREY)
-		{
-			newTree.code = GREY;
-			code += '(';
-			subdivide(newTree);
-			for (int i = 0; i < 8; ++i) {
-				buildTreeFromBooleanOperation(rootA, *rootB.children[i], *newTree.children[i], operation, code, bAisNull, bBisNull);
-			}
-			code += ')';
-		}
-		else
-		{
-			newTree.code = rootB.code;
-			code += codeToChar(rootB.code);
-		}
-		return;
+		return 0.0;
 	}
-	
-	if(bBisNull)
+	if(low.code == BLACK && high.code == BLACK)
 	{
-		if(rootA.code == GREY)
+		return std::min(getFaceArea(low, axis), getFaceArea(high, axis));
+	}
+
+	const int axisBit = 1 << axis;
+	double area = 0.0;
+	for(int i = 0; i < 8; ++i)
+	{
+		if(i & axisBit)
 		{
-			newTree.code = GREY;
-			code += '(';
-			subdivide(newTree);
-			for (int i = 0; i < 8; ++i) {
-				buildTreeFromBooleanOperation(*rootA.children[i], rootB, *newTree.children[i], operation, code, bAisNull, bBisNull);
-			}
-			code += ')';
+			continue;
 		}
-		else
-		{
-			newTree.code = rootA.code;
-			code += codeToChar(rootA.code);
+		const OctreeNode& lowChild = low.code == GREY ? *low.children[i | axisBit] : low;
+		const OctreeNode& highChild = high.code == GREY ? *high.children[i] : high;
+		area += getSharedBlackArea(lowChild, highChild, axis);
+	}
+	return area;
+}
+
+double getSubtreeArea(const OctreeNode& node)
+{
+	if(node.code == WHITE)
+	{
+		return 0.0;
+	}
+	if(node.code == BLACK)
+	{
+		return 2.0 * (getFaceArea(node, 0) + getFaceArea(node, 1) + getFaceArea(node, 2));
+	}
+
+	double area = 0.0;
+	for(const OctreeNode* child : node.children)
+	{
+		area += getSubtreeArea(*child);
+	}
+
+	// Faces between sibling octants, where every touching pair hides a face on both sides
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		const int axisBit = 1 << axis;
+		for(int i = 0; i < 8; ++i)
+		{
+			if(!(i & axisBit))
+			{
+				area -= 2.0 * getSharedBlackArea(*node.children[i], *node.children[i | axisBit], axis);
+			}
 		}
+	}
+	return area;
+}
+
+float getOctreeArea(OctreeNode& node)
+{
+	return static_cast<float>(getSubtreeArea(node));
+}
+
+float getOctreeArea(const Octree& tree)
+{
+	return tree.root ? static_cast<float>(getSubtreeArea(*tree.root) * tree.scale * tree.scale) : 0.f;
+}
+
+bool hasBlack(const OctreeNode& node)
+{
+	return node.code == BLACK || (node.code == GREY && node.blackCount > 0);
+}
+
+/*
+ * Same pairing as getSharedBlackArea(), calling sink.face(black, face, axis, bMaxSide)
+ * wherever a BLACK leaf meets a WHITE one: face's box bounds the contact, bMaxSide says
+ * which side of black it is on.
+ */
+template<typename Sink>
+void visitExposedFaces(Sink& sink, const OctreeNode& low, const OctreeNode& high, int axis)
+{
+	if(!hasBlack(low) && !hasBlack(high))
+	{
 		return;
 	}
-	
-	if((rootA.code == WHITE || rootA.code == BLACK) && (rootB.code == WHITE || rootB.code == BLACK))
+	if(low.code != GREY && high.code != GREY)
 	{
-		if (operation == INTERSECTION) {
-			if(rootA.code == rootB.code)
+		if(low.code != high.code)
+		{
+			const OctreeNode& face = getFaceArea(low, axis) <= getFaceArea(high, axis) ? low : high;
+			if(low.code == BLACK)
 			{
-				newTree.code = BLACK;
-				code += 'B';
+				sink.face(low, face, axis, true);
 			}
 			else
 			{
-				newTree.code = WHITE;
-				code += 'W';
+				sink.face(high, face, axis, false);
 			}
 		}
-		else if (operation == UNION) {
-			if(rootA.code || rootB.code)
+		return;
+	}
+
+	const int axisBit = 1 << axis;
+	for(int i = 0; i < 8; ++i)
+	{
+		if(i & axisBit)
+		{
+			continue;
+		}
+		const OctreeNode& lowChild = low.code == GREY ? *low.children[i | axisBit] : low;
+		const OctreeNode& highChild = high.code == GREY ? *high.children[i] : high;
+		visitExposedFaces(sink, lowChild, highChild, axis);
+	}
+}
+
+template<typename Sink>
+void visitSubtreeFaces(Sink& sink, const OctreeNode& node)
+{
+	if(node.code != GREY || node.blackCount == 0)
+	{
+		return;
+	}
+
+	for(const OctreeNode* child : node.children)
+	{
+		visitSubtreeFaces(sink, *child);
+	}
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		const int axisBit = 1 << axis;
+		for(int i = 0; i < 8; ++i)
+		{
+			if(!(i & axisBit))
 			{
-				newTree.code = BLACK;
-				code += 'B';
+				visitExposedFaces(sink, *node.children[i], *node.children[i | axisBit], axis);
 			}
-			else
+		}
+	}
+}
+
+template<typename Sink>
+void visitOctreeFaces(Sink& sink, const OctreeNode& root)
+{
+	visitSubtreeFaces(sink, root);
+
+	// The root box's own faces, against empty space one root width away on either side
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		glm::vec3 shift(0.0f);
+		shift[axis] = root.posMax.pos[axis] - root.posMin.pos[axis];
+		const OctreeNode below{{root.posMin.pos - shift}, {root.posMax.pos - shift}};
+		const OctreeNode above{{root.posMin.pos + shift}, {root.posMax.pos + shift}};
+		visitExposedFaces(sink, below, root, axis);
+		visitExposedFaces(sink, root, above, axis);
+	}
+}
+
+// Emits every face as its own quad, wound counterclockwise seen from outside and colored by position in black as appendCube() colors the whole cube
+struct FaceMesh
+{
+	const Octree& tree;
+	std::vector<Vertex>& vertices;
+	std::vector<uint32_t>& indices;
+	uint32_t& currentIndex;
+
+	void face(const OctreeNode& black, const OctreeNode& face, int axis, bool bMaxSide)
+	{
+		const int u = (axis + 1) % 3;
+		const int v = (axis + 2) % 3;
+		glm::vec3 corners[4];
+		for(int i = 0; i < 4; ++i)
+		{
+			corners[i][axis] = bMaxSide ? black.posMax.pos[axis] : black.posMin.pos[axis];
+			corners[i][u] = (i == 1 || i == 2) ? face.posMax.pos[u] : face.posMin.pos[u];
+			corners[i][v] = (i >= 2) ? face.posMax.pos[v] : face.posMin.pos[v];
+		}
+		if(!bMaxSide)
+		{
+			std::swap(corners[1], corners[3]);
+		}
+
+		const glm::vec3 blackSize = black.posMax.pos - black.posMin.pos;
+		for(const glm::vec3& corner : corners)
+		{
+			vertices.push_back({getWorldPosition(tree, corner), (corner - black.posMin.pos) / blackSize});
+		}
+
+		const uint32_t quadIndices[] = {0, 1, 2,  0, 2, 3};
+		for(const uint32_t index : quadIndices)
+		{
+			indices.push_back(currentIndex + index);
+		}
+		currentIndex += 4;
+	}
+};
+
+int getSubtreeDepth(const OctreeNode& node)
+{
+	if(node.code != GREY)
+	{
+		return 0;
+	}
+	int depth = 0;
+	for(const OctreeNode* child : node.children)
+	{
+		depth = std::max(depth, getSubtreeDepth(*child));
+	}
+	return depth + 1;
+}
+
+/*
+ * Exposed faces on the integer lattice of the deepest level, 2^depth steps per root side,
+ * so coplanar faces can be compared and merged exactly.
+ */
+struct LatticeFace
+{
+	uint8_t axis;
+	bool bMaxSide;
+	uint32_t plane;
+	uint32_t uMin, uMax, vMin, vMax;
+};
+
+struct LatticeFaceCollector
+{
+	glm::vec3 rootMin;
+	glm::vec3 stepsPerUnit;
+	std::vector<LatticeFace> faces;
+
+	uint32_t toLattice(float position, int axis) const
+	{
+		return static_cast<uint32_t>(std::lround((position - rootMin[axis]) * stepsPerUnit[axis]));
+	}
+
+	void face(const OctreeNode& black, const OctreeNode& face, int axis, bool bMaxSide)
+	{
+		const int u = (axis + 1) % 3;
+		const int v = (axis + 2) % 3;
+		// Faces against the root box come with a stand-in outside it, so clamp to the root
+		const float uMin = std::max(face.posMin.pos[u], black.posMin.pos[u]);
+		const float uMax = std::min(face.posMax.pos[u], black.posMax.pos[u]);
+		const float vMin = std::max(face.posMin.pos[v], black.posMin.pos[v]);
+		const float vMax = std::min(face.posMax.pos[v], black.posMax.pos[v]);
+		faces.push_back({static_cast<uint8_t>(axis), bMaxSide, toLattice(bMaxSide ? black.posMax.pos[axis] : black.posMin.pos[axis], axis),
+			toLattice(uMin, u), toLattice(uMax, u), toLattice(vMin, v), toLattice(vMax, v)});
+	}
+};
+
+/*
+ * Merges the faces of one plane, all sharing axis, side and plane, into maximal
+ * rectangles: the plane is cut into a grid along every face edge, and each uncovered
+ * cell in row order grows as far as it can along u, then along v.
+ */
+void mergeCoplanarFaces(const LatticeFace* faces, size_t count, std::vector<LatticeFace>& merged)
+{
+	std::vector<uint32_t> us;
+	std::vector<uint32_t> vs;
+	for(size_t i = 0; i < count; ++i)
+	{
+		us.push_back(faces[i].uMin);
+		us.push_back(faces[i].uMax);
+		vs.push_back(faces[i].vMin);
+		vs.push_back(faces[i].vMax);
+	}
+	std::sort(us.begin(), us.end());
+	us.erase(std::unique(us.begin(), us.end()), us.end());
+	std::sort(vs.begin(), vs.end());
+	vs.erase(std::unique(vs.begin(), vs.end()), vs.end());
+
+	const size_t columns = us.size() - 1;
+	const size_t rows = vs.size() - 1;
+	// 1 while a cell is covered and not yet taken by a rectangle
+	std::vector<uint8_t> open(columns * rows, 0);
+	for(size_t i = 0; i < count; ++i)
+	{
+		const size_t u0 = std::lower_bound(us.begin(), us.end(), faces[i].uMin) - us.begin();
+		const size_t u1 = std::lower_bound(us.begin(), us.end(), faces[i].uMax) - us.begin();
+		const size_t v0 = std::lower_bound(vs.begin(), vs.end(), faces[i].vMin) - vs.begin();
+		const size_t v1 = std::lower_bound(vs.begin(), vs.end(), faces[i].vMax) - vs.begin();
+		for(size_t row = v0; row < v1; ++row)
+		{
+			std::fill(open.begin() + row * columns + u0, open.begin() + row * columns + u1, 1);
+		}
+	}
+
+	for(size_t row = 0; row < rows; ++row)
+	{
+		for(size_t column = 0; column < columns; ++column)
+		{
+			if(!open[row * columns + column])
+			{
+				continue;
+			}
+
+			size_t columnEnd = column + 1;
+			while(columnEnd < columns && open[row * columns + columnEnd])
+			{
+				++columnEnd;
+			}
+			size_t rowEnd = row + 1;
+			while(rowEnd < rows && std::all_of(open.begin() + rowEnd * columns + column, open.begin() + rowEnd * columns + columnEnd, [](uint8_t cell) { return cell != 0; }))
 			{
-				newTree.code = WHITE;
-				code += 'W';
+				++rowEnd;
 			}
+			for(size_t taken = row; taken < rowEnd; ++taken)
+			{
+				std::fill(open.begin() + taken * columns + column, open.begin() + taken * columns + columnEnd, 0);
+			}
+
+			merged.push_back({faces[0].axis, faces[0].bMaxSide, faces[0].plane, us[column], us[columnEnd], vs[row], vs[rowEnd]});
 		}
 	}
-	else if(rootA.code == WHITE || rootA.code == BLACK)
+}
+
+uint64_t getLatticeLineKey(int axis, uint32_t a, uint32_t b)
+{
+	return (uint64_t(axis) << 62) | (uint64_t(a) << 31) | b;
+}
+
+void populateGreedyFaces(const Octree& tree, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex)
+{
+	const OctreeNode& root = *tree.root;
+	const int depth = getSubtreeDepth(root);
+	if(depth > 30)
 	{
-		boolOperationOneIsLeaf(rootA,rootB,newTree,operation, code);
+		throw std::invalid_argument("octree is too deep for greedy meshing");
 	}
-	
-	else if(rootB.code == WHITE || rootB.code == BLACK)
+	const float steps = std::ldexp(1.0f, depth);
+	const glm::vec3 rootSize = root.posMax.pos - root.posMin.pos;
+
+	LatticeFaceCollector collector{root.posMin.pos, glm::vec3(steps) / rootSize, {}};
+	visitOctreeFaces(collector, root);
+
+	std::sort(collector.faces.begin(), collector.faces.end(), [](const LatticeFace& a, const LatticeFace& b)
+	{
+		return std::make_tuple(a.axis, a.bMaxSide, a.plane) < std::make_tuple(b.axis, b.bMaxSide, b.plane);
+	});
+	std::vector<LatticeFace> merged;
+	for(size_t first = 0; first < collector.faces.size();)
 	{
-		boolOperationOneIsLeaf(rootB,rootA,newTree,operation, code);
+		size_t last = first + 1;
+		while(last < collector.faces.size() && collector.faces[last].axis == collector.faces[first].axis &&
+			collector.faces[last].bMaxSide == collector.faces[first].bMaxSide && collector.faces[last].plane == collector.faces[first].plane)
+		{
+			++last;
+		}
+		mergeCoplanarFaces(&collector.faces[first], last - first, merged);
+		first = last;
 	}
-	if((rootA.code == GREY && rootB.code == GREY) || newTree.code == GREY)
+
+	/*
+	 * A merged rectangle may meet smaller ones along its edges, coplanar or across a
+	 * crease, and a corner of theirs in the middle of its edge would open a crack. Every
+	 * corner is filed under the three axis lines through it, so each edge finds the
+	 * corners lying on it and the rectangle is fanned around its center through them.
+	 */
+	std::unordered_map<uint64_t, std::vector<uint32_t>> lines;
+	auto getCorner = [](const LatticeFace& face, int corner)
 	{
-		code += '(';
-		subdivide(newTree);
-		for (int i = 0; i < 8; ++i) {
-			if(rootA.children[i] == nullptr)
-				bAisNull = true;
-			else
-				bAisNull = false;
-			if(rootB.children[i] == nullptr)
-				bBisNull = true;
-			else
-				bBisNull = false;
-			buildTreeFromBooleanOperation(*rootA.children[i], *rootB.children[i], *newTree.children[i], operation, code, bAisNull, bBisNull);
+		glm::uvec3 point;
+		point[face.axis] = face.plane;
+		point[(face.axis + 1) % 3] = (corner == 1 || corner == 2) ? face.uMax : face.uMin;
+		point[(face.axis + 2) % 3] = corner >= 2 ? face.vMax : face.vMin;
+		return point;
+	};
+	for(const LatticeFace& face : merged)
+	{
+		for(int corner = 0; corner < 4; ++corner)
+		{
+			const glm::uvec3 point = getCorner(face, corner);
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				lines[getLatticeLineKey(axis, point[(axis + 1) % 3], point[(axis + 2) % 3])].push_back(point[axis]);
+			}
+		}
+	}
+	for(auto& line : lines)
+	{
+		std::sort(line.second.begin(), line.second.end());
+		line.second.erase(std::unique(line.second.begin(), line.second.end()), line.second.end());
+	}
+
+	const glm::vec3 stepSize = rootSize / steps;
+	auto toVertex = [&](const glm::vec3& point)
+	{
+		const glm::vec3 local = root.posMin.pos + point * stepSize;
+		return Vertex{getWorldPosition(tree, local), point / steps};
+	};
+
+	std::vector<glm::uvec3> outline;
+	for(const LatticeFace& face : merged)
+	{
+		// Counterclockwise seen from outside, corner by corner with whatever lies on each edge
+		outline.clear();
+		for(int step = 0; step < 4; ++step)
+		{
+			const int corner = face.bMaxSide ? step : (4 - step) % 4;
+			const int nextCorner = face.bMaxSide ? (step + 1) % 4 : (3 - step) % 4;
+			const glm::uvec3 from = getCorner(face, corner);
+			const glm::uvec3 to = getCorner(face, nextCorner);
+			outline.push_back(from);
+
+			const int edgeAxis = from[(face.axis + 1) % 3] != to[(face.axis + 1) % 3] ? (face.axis + 1) % 3 : (face.axis + 2) % 3;
+			const std::vector<uint32_t>& line = lines[getLatticeLineKey(edgeAxis, from[(edgeAxis + 1) % 3], from[(edgeAxis + 2) % 3])];
+			const uint32_t low = std::min(from[edgeAxis], to[edgeAxis]);
+			const uint32_t high = std::max(from[edgeAxis], to[edgeAxis]);
+			auto begin = std::upper_bound(line.begin(), line.end(), low);
+			auto end = std::lower_bound(line.begin(), line.end(), high);
+			const size_t first = outline.size();
+			for(auto it = begin; it != end; ++it)
+			{
+				glm::uvec3 point = from;
+				point[edgeAxis] = *it;
+				outline.push_back(point);
+			}
+			if(from[edgeAxis] > to[edgeAxis])
+			{
+				std::reverse(outline.begin() + first, outline.end());
+			}
+		}
+
+		if(outline.size() == 4)
+		{
+			for(const glm::uvec3& point : outline)
+			{
+				vertices.push_back(toVertex(glm::vec3(point)));
+			}
+			const uint32_t quadIndices[] = {0, 1, 2,  0, 2, 3};
+			for(const uint32_t index : quadIndices)
+			{
+				indices.push_back(currentIndex + index);
+			}
+			currentIndex += 4;
+			continue;
+		}
+
+		const glm::uvec3 first = getCorner(face, 0);
+		const glm::uvec3 opposite = getCorner(face, 2);
+		vertices.push_back(toVertex((glm::vec3(first) + glm::vec3(opposite)) * 0.5f));
+		for(const glm::uvec3& point : outline)
+		{
+			vertices.push_back(toVertex(glm::vec3(point)));
+		}
+		const uint32_t outlineSize = static_cast<uint32_t>(outline.size());
+		for(uint32_t i = 0; i < outlineSize; ++i)
+		{
+			indices.push_back(currentIndex);
+			indices.push_back(currentIndex + 1 + i);
+			indices.push_back(currentIndex + 1 + (i + 1) % outlineSize);
+		}
+		currentIndex += outlineSize + 1;
+	}
+}
+
+void populateFromOctree(const Octree& tree, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex, MeshMode mode)
+{
+	if(!tree.root) return;
+
+	const OctreeNode& root = *tree.root;
+	if(mode == MESH_CUBES)
+	{
+		vertices.reserve(vertices.size() + root.blackCount * 8);
+		indices.reserve(indices.size() + root.blackCount * 36);
+		populateFromOctree(root, tree, vertices, indices, currentIndex);
+	}
+	else if(mode == MESH_EXPOSED_FACES)
+	{
+		FaceMesh mesh{tree, vertices, indices, currentIndex};
+		visitOctreeFaces(mesh, root);
+	}
+	else
+	{
+		populateGreedyFaces(tree, vertices, indices, currentIndex);
+	}
+}
+
+glm::vec3 getCubeRootExtent(const Octree& tree)
+{
+	if(!tree.root) return glm::vec3(0.f);
+
+	return (tree.root->posMax.pos - tree.root->posMin.pos) * tree.scale;
+}
+
+void populateCubeInstances(const OctreeNode& node, const Octree& tree, uint32_t depth, std::vector<CubeInstance>& instances)
+{
+	if(node.code == BLACK)
+	{
+		instances.push_back({getWorldPosition(tree, node.posMin.pos), depth});
+	}
+	else if(node.code == GREY)
+	{
+		for(const OctreeNode* child : node.children)
+		{
+			populateCubeInstances(*child, tree, depth + 1, instances);
+		}
+	}
+}
+
+void populateCubeInstances(const Octree& tree, std::vector<CubeInstance>& instances)
+{
+	if(!tree.root) return;
+
+	instances.reserve(instances.size() + tree.root->blackCount);
+	populateCubeInstances(*tree.root, tree, 0, instances);
+}
+
+void populateCubeInstances(const OctreeNode& node, const Octree& tree, uint32_t depth, const glm::vec3& eye, float childPixelsAtUnitDistance, std::vector<CubeInstance>& instances)
+{
+	if(node.code == WHITE || node.blackCount == 0) return;
+
+	const glm::vec3 posMin = getWorldPosition(tree, node.posMin.pos);
+	const glm::vec3 extent = (node.posMax.pos - node.posMin.pos) * tree.scale;
+	if(node.code == GREY)
+	{
+		// Nearest point of the box, so the whole node passes the test; a camera inside it always refines
+		const float distance = glm::length(eye - glm::clamp(eye, posMin, posMin + extent));
+		// The largest axis, so a flat root box still refines on its long sides
+		if(std::max({extent.x, extent.y, extent.z}) * childPixelsAtUnitDistance >= distance)
+		{
+			for(const OctreeNode* child : node.children)
+			{
+				populateCubeInstances(*child, tree, depth + 1, eye, childPixelsAtUnitDistance, instances);
+			}
+			return;
+		}
+	}
+	instances.push_back({posMin, depth});
+}
+
+void populateCubeInstances(const Octree& tree, const glm::vec3& eye, float pixelsPerUnit, float minChildPixels, std::vector<CubeInstance>& instances)
+{
+	if(!tree.root) return;
+	if(!(pixelsPerUnit > 0.f) || !(minChildPixels > 0.f))
+		throw std::invalid_argument("level of detail needs a positive pixel scale");
+
+	// A child is half its parent's size
+	populateCubeInstances(*tree.root, tree, 0, eye, 0.5f * pixelsPerUnit / minChildPixels, instances);
+}
+
+uint32_t getChunkKey(uint32_t x, uint32_t y, uint32_t z, uint8_t chunkDepth)
+{
+	// Child slot bits x, y, z from the top level down, as in the child order
+	uint32_t key = 0;
+	for(int bit = chunkDepth - 1; bit >= 0; --bit)
+	{
+		key = (key << 3) | (((z >> bit) & 1) << 2) | (((y >> bit) & 1) << 1) | ((x >> bit) & 1);
+	}
+	return key;
+}
+
+template<typename Index>
+ChunkedMesh chunkIndicesByOctree(const Octree& tree, uint8_t chunkDepth, const std::vector<Vertex>& vertices, std::vector<Index>& indices)
+{
+	if(!tree.root)
+		throw std::invalid_argument("cannot chunk a mesh without an octree");
+	if(chunkDepth > MESH_CHUNK_MAX_DEPTH)
+		throw std::invalid_argument("mesh chunk depth too large");
+	if(indices.size() % 3 != 0)
+		throw std::invalid_argument("mesh indices must come in whole triangles");
+
+	const size_t triangles = indices.size() / 3;
+	const uint32_t cellsPerAxis = 1u << chunkDepth;
+	const glm::vec3 rootMin = tree.root->posMin.pos;
+	const glm::vec3 cellSize = (tree.root->posMax.pos - rootMin) / float(cellsPerAxis);
+
+	std::vector<uint32_t> keys(triangles);
+	std::vector<uint32_t> chunkStarts(size_t(1) << (3 * chunkDepth), 0);
+	for(size_t triangle = 0; triangle < triangles; ++triangle)
+	{
+		const glm::vec3 centroid = (vertices[indices[3 * triangle]].pos + vertices[indices[3 * triangle + 1]].pos + vertices[indices[3 * triangle + 2]].pos) / 3.f;
+		// Back into the tree's local space; triangles outside the root box go to the nearest chunk
+		const glm::vec3 cell = glm::floor(((centroid - tree.translation) / tree.scale - rootMin) / cellSize);
+		uint32_t coords[3];
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			coords[axis] = uint32_t(std::min(std::max(cell[axis], 0.f), float(cellsPerAxis - 1)));
+		}
+		keys[triangle] = getChunkKey(coords[0], coords[1], coords[2], chunkDepth);
+		++chunkStarts[keys[triangle]];
+	}
+
+	uint32_t start = 0;
+	for(uint32_t& chunkStart : chunkStarts)
+	{
+		const uint32_t count = chunkStart;
+		chunkStart = start;
+		start += count;
+	}
+
+	ChunkedMesh mesh;
+	mesh.levels.resize(chunkDepth + 1);
+	std::vector<MeshChunk>& chunks = mesh.levels[chunkDepth];
+	chunks.resize(chunkStarts.size(), {0, 0, glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::lowest())});
+	for(size_t chunk = 0; chunk < chunks.size(); ++chunk)
+	{
+		chunks[chunk].firstIndex = 3 * chunkStarts[chunk];
+	}
+
+	// Stable, so each chunk keeps the triangles in the order they came
+	std::vector<Index> chunkedIndices(indices.size());
+	for(size_t triangle = 0; triangle < triangles; ++triangle)
+	{
+		MeshChunk& chunk = chunks[keys[triangle]];
+		for(int corner = 0; corner < 3; ++corner)
+		{
+			const Index index = indices[3 * triangle + corner];
+			chunkedIndices[chunk.firstIndex + chunk.indexCount++] = index;
+			chunk.boundsMin = glm::min(chunk.boundsMin, vertices[index].pos);
+			chunk.boundsMax = glm::max(chunk.boundsMax, vertices[index].pos);
+		}
+	}
+	indices.swap(chunkedIndices);
+
+	for(int level = chunkDepth - 1; level >= 0; --level)
+	{
+		const std::vector<MeshChunk>& children = mesh.levels[level + 1];
+		std::vector<MeshChunk>& nodes = mesh.levels[level];
+		nodes.resize(children.size() / 8);
+		for(size_t node = 0; node < nodes.size(); ++node)
+		{
+			nodes[node] = children[8 * node];
+			for(size_t child = 8 * node + 1; child < 8 * node + 8; ++child)
+			{
+				nodes[node].indexCount += children[child].indexCount;
+				nodes[node].boundsMin = glm::min(nodes[node].boundsMin, children[child].boundsMin);
+				nodes[node].boundsMax = glm::max(nodes[node].boundsMax, children[child].boundsMax);
+			}
+		}
+	}
+	return mesh;
+}
+
+ChunkedMesh chunkMeshByOctree(const Octree& tree, uint8_t chunkDepth, const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	return chunkIndicesByOctree(tree, chunkDepth, vertices, indices);
+}
+
+ChunkedMesh chunkMeshByOctree(const Octree& tree, uint8_t chunkDepth, const std::vector<Vertex>& vertices, std::vector<uint16_t>& indices)
+{
+	return chunkIndicesByOctree(tree, chunkDepth, vertices, indices);
+}
+
+struct LatticePointHash
+{
+	size_t operator()(const glm::uvec3& point) const
+	{
+		return std::hash<uint64_t>()((uint64_t(point.x) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(point.y) << 21) ^ (uint64_t(point.z) << 42));
+	}
+};
+
+void appendIndexedMesh(const Octree& tree, MeshMode mode, IndexedMesh& mesh)
+{
+	if(!tree.root) return;
+
+	// Half steps of the deepest level, so greedy fan centers land on the lattice too
+	const OctreeNode& root = *tree.root;
+	const int depth = getSubtreeDepth(root) + 1;
+	if(depth > 31)
+	{
+		throw std::invalid_argument("octree is too deep for an indexed mesh");
+	}
+	const float steps = std::ldexp(1.0f, depth);
+	const glm::vec3 stepsPerUnit = glm::vec3(steps) / (root.posMax.pos - root.posMin.pos);
+
+	// Built in the tree's own frame, where every vertex sits on the lattice
+	std::vector<Vertex> looseVertices;
+	std::vector<uint32_t> looseIndices;
+	uint32_t looseCount = 0;
+	populateFromOctree(Octree{tree.root}, looseVertices, looseIndices, looseCount, mode);
+
+	std::vector<uint32_t> indices = std::move(mesh.indices);
+	indices.insert(indices.end(), mesh.shortIndices.begin(), mesh.shortIndices.end());
+	mesh.shortIndices.clear();
+
+	std::unordered_map<glm::uvec3, uint32_t, LatticePointHash> welded;
+	welded.reserve(looseVertices.size() / 4);
+	std::vector<uint32_t> remap(looseVertices.size());
+	for(size_t i = 0; i < looseVertices.size(); ++i)
+	{
+		const glm::vec3 local = looseVertices[i].pos;
+		const glm::vec3 scaled = (local - root.posMin.pos) * stepsPerUnit;
+		// 64-bit rounding, as long is 32 bits under MSVC and the far corner sits at 2^31
+		const glm::uvec3 point(std::llround(scaled.x), std::llround(scaled.y), std::llround(scaled.z));
+
+		auto inserted = welded.emplace(point, static_cast<uint32_t>(mesh.vertices.size()));
+		if(inserted.second)
+		{
+			mesh.vertices.push_back({getWorldPosition(tree, local), glm::vec3(point) / steps});
+		}
+		remap[i] = inserted.first->second;
+	}
+	indices.reserve(indices.size() + looseIndices.size());
+	for(const uint32_t index : looseIndices)
+	{
+		indices.push_back(remap[index]);
+	}
+
+	if(mesh.vertices.size() <= 65536)
+	{
+		mesh.shortIndices.assign(indices.begin(), indices.end());
+	}
+	else
+	{
+		mesh.indices = std::move(indices);
+	}
+}
+
+// Copies src's subtree under dst, which already has its box, swapping BLACK and WHITE when asked
+NodeCode copyBooleanSubtree(const OctreeNode& src, OctreeNode& dst, OctreeArena& arena, bool bComplement, std::string& code)
+{
+	if(src.code != GREY)
+	{
+		dst.code = bComplement ? (src.code == BLACK ? WHITE : BLACK) : src.code;
+		code += codeToChar(dst.code);
+		updateAggregates(dst);
+		return dst.code;
+	}
+
+	dst.code = GREY;
+	subdivide(dst, arena);
+	code += '(';
+	for(int i = 0; i < 8; ++i)
+	{
+		copyBooleanSubtree(*src.children[i], *dst.children[i], arena, bComplement, code);
+	}
+	code += ')';
+	updateAggregates(dst);
+	return GREY;
+}
+
+// Everything a node's result takes that its two operands do not settle on their own
+NodeCode buildBooleanLeafOrCopy(const OctreeNode& rootA, const OctreeNode& rootB, OctreeNode& newTree, OctreeArena& arena, const Operation& operation, std::string& code)
+{
+	const NodeCode result = decideBooleanOperation(rootA.code, rootB.code, operation);
+	if(result != GREY)
+	{
+		newTree.code = result;
+		code += codeToChar(result);
+		updateAggregates(newTree);
+		return result;
+	}
+
+	// Only a BLACK minuend leaves DIFFERENCE undecided, and it keeps what rootB does not cover
+	if(rootA.code != GREY)
+	{
+		return copyBooleanSubtree(rootB, newTree, arena, operation == DIFFERENCE, code);
+	}
+	return copyBooleanSubtree(rootA, newTree, arena, false, code);
+}
+
+NodeCode buildBooleanSubtree(const OctreeNode& rootA, const OctreeNode& rootB, OctreeNode& newTree, OctreeArena& arena, const Operation& operation, std::string& code)
+{
+	if(rootA.code != GREY || rootB.code != GREY)
+	{
+		return buildBooleanLeafOrCopy(rootA, rootB, newTree, arena, operation, code);
+	}
+
+	const OctreeArena::Mark mark = arena.getMark();
+	newTree.code = GREY;
+	subdivide(newTree, arena);
+	bool bBlackBranch = true;
+	bool bWhiteBranch = true;
+
+	code += '(';
+	for(int i = 0; i < 8; ++i)
+	{
+		const NodeCode child = buildBooleanSubtree(*rootA.children[i], *rootB.children[i], *newTree.children[i], arena, operation, code);
+		bBlackBranch = bBlackBranch && child == BLACK;
+		bWhiteBranch = bWhiteBranch && child == WHITE;
+	}
+
+	if(bBlackBranch || bWhiteBranch)
+	{
+		code.resize(code.size() - 9);
+		newTree.code = bBlackBranch ? BLACK : WHITE;
+		code += codeToChar(newTree.code);
+		newTree.children = {};
+		arena.rewind(mark);
+		updateAggregates(newTree);
+		return newTree.code;
+	}
+
+	code += ')';
+	updateAggregates(newTree);
+	return GREY;
+}
+
+NodeCode buildBooleanTreeParallel(const OctreeNode& rootA, const OctreeNode& rootB, OctreeNode& newTree, OctreeArena& arena, const Operation& operation, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	if(!scheduler || parallelDepth <= 0 || rootA.code != GREY || rootB.code != GREY)
+	{
+		return buildBooleanSubtree(rootA, rootB, newTree, arena, operation, code);
+	}
+
+	const OctreeArena::Mark mark = arena.getMark();
+	newTree.code = GREY;
+	subdivide(newTree, arena);
+
+	// Same split as buildTreeParallel: every child pair writes its own code into its own arena
+	std::array<std::string, 8> childCodes;
+	std::array<OctreeArena, 8> childArenas;
+	std::array<NodeCode, 8> childResults;
+	MTaskScheduler::TaskGroup group;
+	for(int i = 0; i < 8; ++i)
+	{
+		scheduler->run(group, [&, i]
+		{
+			childResults[i] = buildBooleanTreeParallel(*rootA.children[i], *rootB.children[i], *newTree.children[i], childArenas[i], operation, childCodes[i], scheduler, parallelDepth - 1);
+		});
+	}
+	scheduler->wait(group);
+
+	const bool bBlackBranch = std::all_of(childResults.begin(), childResults.end(), [](NodeCode result) { return result == BLACK; });
+	const bool bWhiteBranch = std::all_of(childResults.begin(), childResults.end(), [](NodeCode result) { return result == WHITE; });
+	if(bBlackBranch || bWhiteBranch)
+	{
+		newTree.code = bBlackBranch ? BLACK : WHITE;
+		code += codeToChar(newTree.code);
+		newTree.children = {};
+		arena.rewind(mark);
+		updateAggregates(newTree);
+		return newTree.code;
+	}
+
+	code += '(';
+	for(int i = 0; i < 8; ++i)
+	{
+		code += childCodes[i];
+		arena.adopt(std::move(childArenas[i]));
+	}
+	code += ')';
+	updateAggregates(newTree);
+	return GREY;
+}
+
+void buildTreeFromBooleanOperation(const OctreeNode& rootA, const OctreeNode& rootB, OctreeNode& newTree, OctreeArena& arena, const Operation& operation, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	buildBooleanTreeParallel(rootA, rootB, newTree, arena, operation, code, scheduler, parallelDepth);
+}
+
+void buildTreeFromBooleanOperation(const Octree& treeA, const Octree& treeB, Octree& newTree, OctreeArena& arena, const Operation& operation, std::string& code, MTaskScheduler* scheduler, int parallelDepth)
+{
+	glm::vec3 minA, maxA, minB, maxB;
+	getOctreeBounds(treeA, minA, maxA);
+	getOctreeBounds(treeB, minB, maxB);
+
+	// Relative to the box, so trees that went through different but equivalent transforms still match
+	const glm::vec3 extent = maxA - minA;
+	const float tolerance = 1e-5f * std::max(extent.x, std::max(extent.y, extent.z));
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		if(std::abs(minA[axis] - minB[axis]) > tolerance || std::abs(maxA[axis] - maxB[axis]) > tolerance)
+		{
+			throw std::invalid_argument("boolean operands must share their root box in world space");
+		}
+	}
+
+	newTree.root->posMin = treeA.root->posMin;
+	newTree.root->posMax = treeA.root->posMax;
+	newTree.translation = treeA.translation;
+	newTree.scale = treeA.scale;
+	buildBooleanTreeParallel(*treeA.root, *treeB.root, *newTree.root, arena, operation, code, scheduler, parallelDepth);
+}
+
+int CsgExpression::addInput(int input)
+{
+	if(input < 0)
+	{
+		throw std::invalid_argument("CSG input index must not be negative");
+	}
+	nodes.push_back({input, UNION, -1, -1});
+	return static_cast<int>(nodes.size()) - 1;
+}
+
+int CsgExpression::addOperation(Operation operation, int left, int right)
+{
+	const int count = static_cast<int>(nodes.size());
+	if(left < 0 || left >= count || right < 0 || right >= count)
+	{
+		throw std::invalid_argument("CSG operands must be added before the operation using them");
+	}
+	nodes.push_back({-1, operation, left, right});
+	return count;
+}
+
+/*
+ * State of one buildTreeFromCsgExpression() run. operands holds one row of inputCount
+ * nodes per level: the input's own node while it is GREY, or the leaf that covers the
+ * whole region. values is scratch for evaluating the expression at one node.
+ */
+struct CsgTraversal
+{
+	const CsgExpression& expression;
+	size_t inputCount;
+	std::vector<const OctreeNode*> operands;
+	std::vector<NodeCode> values;
+	OctreeArena& arena;
+	std::string& code;
+};
+
+// Three-valued: GREY wherever an operand's detail still matters
+NodeCode evaluateCsgExpression(CsgTraversal& traversal, size_t level)
+{
+	const OctreeNode* const* operands = &traversal.operands[level * traversal.inputCount];
+	const std::vector<CsgExpression::Node>& nodes = traversal.expression.nodes;
+	for(size_t i = 0; i < nodes.size(); ++i)
+	{
+		const CsgExpression::Node& node = nodes[i];
+		traversal.values[i] = node.input >= 0 ? operands[node.input]->code : decideBooleanOperation(traversal.values[node.left], traversal.values[node.right], node.operation);
+	}
+	return traversal.values.back();
+}
+
+NodeCode buildCsgSubtree(CsgTraversal& traversal, size_t level, OctreeNode& newTree)
+{
+	const NodeCode result = evaluateCsgExpression(traversal, level);
+	if(result != GREY)
+	{
+		newTree.code = result;
+		traversal.code += codeToChar(result);
+		updateAggregates(newTree);
+		return result;
+	}
+
+	const size_t inputCount = traversal.inputCount;
+	if(traversal.operands.size() < (level + 2) * inputCount)
+	{
+		traversal.operands.resize((level + 2) * inputCount);
+	}
+
+	const OctreeArena::Mark mark = traversal.arena.getMark();
+	newTree.code = GREY;
+	subdivide(newTree, traversal.arena);
+	bool bBlackBranch = true;
+	bool bWhiteBranch = true;
+
+	traversal.code += '(';
+	for(int i = 0; i < 8; ++i)
+	{
+		for(size_t k = 0; k < inputCount; ++k)
+		{
+			const OctreeNode* operand = traversal.operands[level * inputCount + k];
+			traversal.operands[(level + 1) * inputCount + k] = operand->code == GREY ? operand->children[i] : operand;
+		}
+
+		const NodeCode child = buildCsgSubtree(traversal, level + 1, *newTree.children[i]);
+		bBlackBranch = bBlackBranch && child == BLACK;
+		bWhiteBranch = bWhiteBranch && child == WHITE;
+	}
+
+	if(bBlackBranch || bWhiteBranch)
+	{
+		traversal.code.resize(traversal.code.size() - 9);
+		newTree.code = bBlackBranch ? BLACK : WHITE;
+		traversal.code += codeToChar(newTree.code);
+		newTree.children = {};
+		traversal.arena.rewind(mark);
+		updateAggregates(newTree);
+		return newTree.code;
+	}
+
+	traversal.code += ')';
+	updateAggregates(newTree);
+	return GREY;
+}
+
+void buildTreeFromCsgExpression(const CsgExpression& expression, const std::vector<const OctreeNode*>& inputs, OctreeNode& newTree, OctreeArena& arena, std::string& code)
+{
+	if(expression.nodes.empty())
+	{
+		throw std::invalid_argument("CSG expression is empty");
+	}
+	for(const CsgExpression::Node& node : expression.nodes)
+	{
+		if(node.input >= static_cast<int>(inputs.size()) || (node.input >= 0 && !inputs[node.input]))
+		{
+			throw std::invalid_argument("CSG expression names an input tree that was not given");
 		}
-		code += ')';
 	}
+
+	CsgTraversal traversal{expression, inputs.size(), std::vector<const OctreeNode*>(inputs.begin(), inputs.end()), std::vector<NodeCode>(expression.nodes.size()), arena, code};
+	buildCsgSubtree(traversal, 0, newTree);
+}
+
+/*
+ * Leaves of one operand that fall inside the region being visited. code is BLACK/WHITE
+ * once a single leaf (or nothing) covers the region, GREY while it still has detail.
+ */
+struct LinearRange
+{
+	const LinearOctree* tree;
+	size_t first;
+	size_t last;
+	NodeCode code;
+};
+
+LinearRange narrowLinearRange(const LinearRange& range, uint64_t key, uint8_t level, uint8_t maxDepth)
+{
+	if(range.code != GREY)
+	{
+		return range;
+	}
+
+	const std::vector<uint64_t>& keys = range.tree->keys;
+	const uint64_t span = uint64_t(1) << (3 * (maxDepth - level));
+	LinearRange child{range.tree};
+	child.first = std::lower_bound(keys.begin() + range.first, keys.begin() + range.last, key) - keys.begin();
+	child.last = std::lower_bound(keys.begin() + child.first, keys.begin() + range.last, key + span) - keys.begin();
+
+	if(child.first == child.last)
+	{
+		child.code = WHITE;
+	}
+	else if(range.tree->levels[child.first] <= level)
+	{
+		child.code = BLACK;
+	}
+	else
+	{
+		child.code = GREY;
+	}
+	return child;
+}
+
+NodeCode decideBooleanOperation(NodeCode a, NodeCode b, const Operation& operation)
+{
+	if (operation == INTERSECTION) {
+		if(a == WHITE || b == WHITE) return WHITE;
+		if(a == BLACK && b == BLACK) return BLACK;
+	}
+	else if (operation == UNION) {
+		if(a == BLACK || b == BLACK) return BLACK;
+		if(a == WHITE && b == WHITE) return WHITE;
+	}
+	else {
+		if(a == WHITE || b == BLACK) return WHITE;
+		if(a == BLACK && b == WHITE) return BLACK;
+	}
+	return GREY;
+}
+
+NodeCode buildLinearTreeFromBooleanOperation(const LinearRange& parentA, const LinearRange& parentB, LinearOctree& newTree, const Operation& operation, std::string& code, uint64_t key, uint8_t level)
+{
+	const LinearRange rangeA = narrowLinearRange(parentA, key, level, newTree.maxDepth);
+	const LinearRange rangeB = narrowLinearRange(parentB, key, level, newTree.maxDepth);
+
+	const NodeCode result = decideBooleanOperation(rangeA.code, rangeB.code, operation);
+	if(result == WHITE)
+	{
+		code += 'W';
+		return WHITE;
+	}
+	if(result == BLACK)
+	{
+		newTree.keys.push_back(key);
+		newTree.levels.push_back(level);
+		code += 'B';
+		return BLACK;
+	}
+
+	const int childShift = 3 * (newTree.maxDepth - level - 1);
+	bool bBlackBranch = true;
+	bool bWhiteBranch = true;
+
+	code += '(';
+	for(int i = 0; i < 8; ++i)
+	{
+		const NodeCode child = buildLinearTreeFromBooleanOperation(rangeA, rangeB, newTree, operation, code, key | (static_cast<uint64_t>(i) << childShift), level + 1);
+		bBlackBranch = bBlackBranch && child == BLACK;
+		bWhiteBranch = bWhiteBranch && child == WHITE;
+	}
+
+	if(bWhiteBranch)
+	{
+		code.resize(code.size() - 9);
+		code += 'W';
+		return WHITE;
+	}
+
+	if(bBlackBranch)
+	{
+		code.resize(code.size() - 9);
+		code += 'B';
+		newTree.keys.resize(newTree.keys.size() - 8);
+		newTree.levels.resize(newTree.levels.size() - 8);
+		newTree.keys.push_back(key);
+		newTree.levels.push_back(level);
+		return BLACK;
+	}
+
+	code += ')';
+	return GREY;
 }
 
+LinearOctree deepenLinearTree(const LinearOctree& oct, uint8_t maxDepth)
+{
+	LinearOctree deeper = oct;
+	deeper.maxDepth = maxDepth;
+	for(uint64_t& key : deeper.keys)
+	{
+		key <<= 3 * (maxDepth - oct.maxDepth);
+	}
+	return deeper;
+}
+
+void buildTreeFromBooleanOperation(const LinearOctree& treeA, const LinearOctree& treeB, LinearOctree& newTree, const Operation& operation, std::string& code)
+{
+	newTree.posMin = treeA.posMin;
+	newTree.posMax = treeA.posMax;
+	newTree.maxDepth = std::max(treeA.maxDepth, treeB.maxDepth);
+	newTree.keys.clear();
+	newTree.levels.clear();
+
+	// Keys are only comparable at the same resolution
+	const LinearOctree deeperA = treeA.maxDepth == newTree.maxDepth ? LinearOctree{} : deepenLinearTree(treeA, newTree.maxDepth);
+	const LinearOctree deeperB = treeB.maxDepth == newTree.maxDepth ? LinearOctree{} : deepenLinearTree(treeB, newTree.maxDepth);
+	const LinearOctree* a = treeA.maxDepth == newTree.maxDepth ? &treeA : &deeperA;
+	const LinearOctree* b = treeB.maxDepth == newTree.maxDepth ? &treeB : &deeperB;
+
+	const LinearRange rootA{a, 0, a->keys.size(), GREY};
+	const LinearRange rootB{b, 0, b->keys.size(), GREY};
+	buildLinearTreeFromBooleanOperation(rootA, rootB, newTree, operation, code, 0, 0);
+}
+
+
 // void buildTree(MCylinder cylinder ...)
 // {
 // 	
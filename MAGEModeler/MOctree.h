@@ -2,6 +2,8 @@
 #include <cstdint>
 #include <array>
 #include <algorithm>
+#include <memory>
+#include <glm/mat4x4.hpp>
 #include "MModel.h"
 #include "Primitives.h"
 /*
@@ -12,6 +14,8 @@
 enum NodeCode {WHITE, BLACK, GREY}; 
 enum Operation {INTERSECTION, UNION, DIFFERENCE}; 
 
+class MTaskScheduler;
+
 struct OctreeNode
 {
 	Vertex posMin;
@@ -21,40 +25,270 @@ struct OctreeNode
 	
 	NodeCode code = WHITE;
 
+	// Over the whole subtree, kept current by every builder and by paintOctreeRegion()
+	float volume = 0.f;
+	uint32_t blackCount = 0;
+	uint32_t greyCount = 0;
+};
+
+/*
+ * Owns every node of one tree. Children are handed out eight at a time from chunks
+ * that grow geometrically; reset() drops the whole tree in O(1) and keeps the chunks,
+ * so rebuilding into the same arena runs at a flat footprint.
+ */
+class OctreeArena
+{
+public:
+	OctreeArena() = default;
+	OctreeArena(const OctreeArena&) = delete;
+	OctreeArena& operator=(const OctreeArena&) = delete;
+	OctreeArena(OctreeArena&&) = default;
+	OctreeArena& operator=(OctreeArena&&) = default;
+
+	// Eight contiguous, value-initialized nodes
+	OctreeNode* allocateChildren();
+
+	void reset();
+
+	// Everything allocated after getMark() is dropped by rewind(), for collapsed subtrees
+	struct Mark
+	{
+		size_t chunk;
+		size_t usedBlocks;
+		size_t nodeCount;
+	};
+	Mark getMark() const;
+	void rewind(const Mark& mark);
+
+	// Takes over every node of other, e.g. a subtree built by another thread
+	void adopt(OctreeArena&& other);
+
+	// Frees the chunks too, for when the tree will not be rebuilt
+	void release();
+
+	size_t getNodeCount() const { return nodeCount; }
+
+private:
+	static constexpr size_t FIRST_CHUNK_BLOCKS = 16;
+	static constexpr size_t MAX_CHUNK_BLOCKS = 8192;
+
+	struct Chunk
+	{
+		std::unique_ptr<OctreeNode[]> nodes;
+		size_t blocks;
+	};
+
+	std::vector<Chunk> chunks;
+	// Adopted chunks are full of live nodes until the next reset()
+	std::vector<Chunk> adoptedChunks;
+	size_t currentChunk = 0;
+	size_t usedBlocks = 0;
+	size_t nodeCount = 0;
 };
 
+/*
+ * An octree placed in the world. Nodes keep the box they were built in and
+ * world = local * scale + translation, so moving or uniformly scaling a whole tree is
+ * a metadata update that never touches a node.
+ */
 struct Octree
 {
-	OctreeNode* root;
+	OctreeNode* root = nullptr;
+	glm::vec3 translation{0.f};
+	float scale = 1.f;
+};
+
+// Both O(1). Scaling is about the world origin; factor must be positive or std::invalid_argument is thrown
+void translateOctree(Octree& tree, const glm::vec3& offset);
+void scaleOctree(Octree& tree, float factor);
+glm::vec3 getWorldPosition(const Octree& tree, const glm::vec3& local);
+// Root box in world space
+void getOctreeBounds(const Octree& tree, glm::vec3& posMin, glm::vec3& posMax);
+
+/*
+ * Pointerless octree. Only BLACK leaves are stored, in preorder, as the Morton key of
+ * their min corner at maxDepth resolution (3 bits per level, child slot laid out as
+ * subdivide() does: x = 1, y = 2, z = 4) plus the level they sit at (0 = root).
+ * Every bound is implicit from the root box.
+ */
+struct LinearOctree
+{
+	glm::vec3 posMin{};
+	glm::vec3 posMax{};
+	uint8_t maxDepth = 0;
+	std::vector<uint64_t> keys;
+	std::vector<uint8_t> levels;
 };
 
+constexpr uint8_t LINEAR_OCTREE_MAX_DEPTH = 21;
+
+// One cube, 8 vertices and 36 indices, colored by local position
+void appendCube(const glm::vec3& posMin, const glm::vec3& posMax, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex);
 void populateFromOctree(OctreeNode* node, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex);
+void populateFromOctree(const LinearOctree& oct, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex);
+/*
+ * MESH_CUBES emits every BLACK leaf as a whole cube. MESH_EXPOSED_FACES only emits the
+ * faces that border a WHITE leaf or the root box, split where a finer neighbor only
+ * covers part of them, as outward wound quads. MESH_GREEDY_FACES merges those faces,
+ * plane by plane, into maximal rectangles colored by position in the root box; a
+ * rectangle with other corners on its edges is fanned through them, so it leaves no cracks.
+ */
+enum MeshMode {MESH_CUBES, MESH_EXPOSED_FACES, MESH_GREEDY_FACES};
+// The mesh comes out in world space
+void populateFromOctree(const Octree& tree, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex, MeshMode mode = MESH_CUBES);
+
+/*
+ * Vertices shared through the index buffer. Indices are 16-bit while every vertex fits
+ * them and 32-bit past that; only one of the two is filled.
+ */
+struct IndexedMesh
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint16_t> shortIndices;
+	std::vector<uint32_t> indices;
+};
+// Appends tree's mesh with coincident vertices welded on its lattice, colored by position in the root box
+void appendIndexedMesh(const Octree& tree, MeshMode mode, IndexedMesh& mesh);
+
+// World extent of the root box, the size of a CubeInstance at depth zero
+glm::vec3 getCubeRootExtent(const Octree& tree);
+// One world-space instance per BLACK leaf, for drawing every leaf off a single unit cube
+void populateCubeInstances(const Octree& tree, std::vector<CubeInstance>& instances);
+/*
+ * The same, cut for a camera at eye: a GREY node is drawn as one cube once its children, at
+ * their nearest distance from eye, would cover less than minChildPixels. pixelsPerUnit is the
+ * screen size of a unit length at distance one. Only the cut is walked, so the work follows
+ * the screen size rather than the leaf count.
+ */
+void populateCubeInstances(const Octree& tree, const glm::vec3& eye, float pixelsPerUnit, float minChildPixels, std::vector<CubeInstance>& instances);
+
+/*
+ * A run of whole triangles in a chunked index buffer and the bounds of their vertices,
+ * inverted (min above max) when the run is empty.
+ */
+struct MeshChunk
+{
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+};
+/*
+ * A mesh's triangles grouped by the octree node at depth levels.size() - 1 whose box holds
+ * their centroid. levels[l] has the 8^l nodes of depth l in Morton order, so the triangles under
+ * any node are one contiguous run and a node inside the frustum draws with a single call.
+ */
+struct ChunkedMesh
+{
+	std::vector<std::vector<MeshChunk>> levels;
+};
+constexpr uint8_t MESH_CHUNK_MAX_DEPTH = 4;
+// Reorders indices into chunks of tree's nodes at chunkDepth; vertices are in world space, as populateFromOctree makes them
+ChunkedMesh chunkMeshByOctree(const Octree& tree, uint8_t chunkDepth, const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+ChunkedMesh chunkMeshByOctree(const Octree& tree, uint8_t chunkDepth, const std::vector<Vertex>& vertices, std::vector<uint16_t>& indices);
 
 OctreeNode createNodeForSphere(const Sphere& sphere);
 OctreeNode createNodeForBlock(const Block& block);
 OctreeNode createNodeForCylinder(const Cylinder& cylinder);
 OctreeNode createNodeForCone(const Cone& cone);
-void buildTree(MModel& model, OctreeNode& oct, int depth, std::string& code);
-void buildTree(Sphere& model, OctreeNode& oct, int depth, std::string& code);
-void buildTree(Block& model, OctreeNode& oct, int depth, std::string& code);
-void buildTree(Cylinder& model, OctreeNode& oct, int depth, std::string& code);
-void buildTree(Cone& model, OctreeNode& oct, int depth, std::string& code);
+LinearOctree createLinearOctree(const OctreeNode& root);
+// Hands oct eight children from arena, each an octant of oct's box
+void subdivide(OctreeNode& oct, OctreeArena& arena);
+// Recomputes oct's cached aggregates from its code and its children's aggregates
+void updateAggregates(OctreeNode& oct);
+// With a scheduler, every subtree parallelDepth levels below the root is built as its own task
+void buildTree(MModel& model, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+void buildTree(Sphere& model, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+void buildTree(Block& model, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+void buildTree(Cylinder& model, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+void buildTree(Cone& model, OctreeNode& oct, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+// oct.posMin/posMax must hold the root box, depth becomes oct.maxDepth
+void buildTree(MModel& model, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+void buildTree(Sphere& model, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+void buildTree(Block& model, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+void buildTree(Cylinder& model, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+void buildTree(Cone& model, LinearOctree& oct, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
 
 void readCodeAndPopulateTree(OctreeNode& oct, std::string& code);
 
-OctreeNode buildTreeFromCode(std::string& code, glm::vec3 posMin = glm::vec3(-5.0f, -5.0f, -5.0f), glm::vec3 posMax = glm::vec3(5.0f, 5.0f, 5.0f));
+OctreeNode buildTreeFromCode(std::string& code, OctreeArena& arena, glm::vec3 posMin = glm::vec3(-5.0f, -5.0f, -5.0f), glm::vec3 posMax = glm::vec3(5.0f, 5.0f, 5.0f));
+LinearOctree buildLinearTreeFromCode(const std::string& code, glm::vec3 posMin = glm::vec3(-5.0f, -5.0f, -5.0f), glm::vec3 posMax = glm::vec3(5.0f, 5.0f, 5.0f));
 
 OctreeNode buildInitialBoundingBox(MModel& m);
 
-void buildTreeFromBooleanOperation(const OctreeNode& rootA, const OctreeNode& rootB, OctreeNode& newTree, const Operation& operation, std::string& code, bool bAisNull = false, bool bBisNull = false);
+// Both trees are taken in newTree's box. With a scheduler, child pairs parallelDepth levels deep become tasks
+void buildTreeFromBooleanOperation(const OctreeNode& rootA, const OctreeNode& rootB, OctreeNode& newTree, OctreeArena& arena, const Operation& operation, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+// Both trees are taken in treeA's root box; newTree gets the deeper of the two maxDepths
+void buildTreeFromBooleanOperation(const LinearOctree& treeA, const LinearOctree& treeB, LinearOctree& newTree, const Operation& operation, std::string& code);
+/*
+ * Placed trees have to share their root box in world space, otherwise their octants do
+ * not line up and std::invalid_argument is thrown. newTree.root must point to the node to
+ * build into; it gets treeA's root box and newTree gets treeA's transform.
+ */
+void buildTreeFromBooleanOperation(const Octree& treeA, const Octree& treeB, Octree& newTree, OctreeArena& arena, const Operation& operation, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+// WHITE or BLACK when a and b settle the result on their own, GREY when it takes their children
+NodeCode decideBooleanOperation(NodeCode a, NodeCode b, const Operation& operation);
 
+/*
+ * CSG expression over any number of input octrees, kept flat: a node either names an
+ * input tree or combines two earlier nodes, so operands always come before the
+ * operation using them and the last node added is the root.
+ */
+struct CsgExpression
+{
+	struct Node
+	{
+		int input;
+		Operation operation;
+		int left;
+		int right;
+	};
+	std::vector<Node> nodes;
+
+	// Both return the index of the new node; addOperation throws on operands not added yet
+	int addInput(int input);
+	int addOperation(Operation operation, int left, int right);
+};
+
+// One traversal of every input at once, in newTree's box, pruning wherever the expression is already decided
+void buildTreeFromCsgExpression(const CsgExpression& expression, const std::vector<const OctreeNode*>& inputs, OctreeNode& newTree, OctreeArena& arena, std::string& code);
+
+/*
+ * Builds source moved by transform (source frame to target frame, any invertible affine
+ * map: rotations, non-uniform scales, shears) into newTree, whose box is the target
+ * region. Cells at depth take the source color at their center. Throws
+ * std::invalid_argument when transform is singular.
+ */
+void buildTreeFromResampling(const OctreeNode& source, const glm::mat4& transform, OctreeNode& newTree, OctreeArena& arena, int depth, std::string& code, MTaskScheduler* scheduler = nullptr, int parallelDepth = 0);
+// Smallest cube around source's box once transformed, as a root for buildTreeFromResampling()
+OctreeNode buildResampledBoundingBox(const OctreeNode& source, const glm::mat4& transform);
+
+// O(1) off the cached aggregates
 float getOctreeVolume(OctreeNode* node);
+float getOctreeVolume(const LinearOctree& oct);
+float getOctreeVolume(const Octree& tree);
 
 void getOctreeBlackNodes(OctreeNode* node, std::vector<OctreeNode*>& blackNodes);
 
+/*
+ * Makes the region at path (child slots from root down) a BLACK or WHITE leaf. Leaves on
+ * the way are split, uniform siblings on the way back merge, and only the aggregates
+ * along the path are refreshed, so an edit costs O(depth). Dropped nodes stay in arena
+ * until its next reset().
+ */
+void paintOctreeRegion(OctreeNode& root, const std::vector<uint8_t>& path, NodeCode code, OctreeArena& arena);
+
+// Boundary between BLACK and everything else, the root box's faces included; O(n)
 float getOctreeArea(OctreeNode& node);
+float getOctreeArea(const Octree& tree);
 
 bool isCollidingAABB_Sphere(const OctreeNode& cube, const Sphere& sphere);
 bool isCollidingAABB_Block(const OctreeNode& cube, const Block& block);
 bool isCollidingAABB_Cylinder(const OctreeNode& cube, const Cylinder& cylinder);
 bool isCollidingAABB_Cone(const OctreeNode& cube, const Cone& cone);
+
+// True when the cube lies entirely inside the shape
+bool isContainedAABB_Sphere(const OctreeNode& cube, const Sphere& sphere);
+bool isContainedAABB_Block(const OctreeNode& cube, const Block& block);
+bool isContainedAABB_Cylinder(const OctreeNode& cube, const Cylinder& cylinder);
+bool isContainedAABB_Cone(const OctreeNode& cube, const Cone& cone);
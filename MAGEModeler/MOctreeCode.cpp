@@ -0,0 +1,317 @@
+﻿#include "MOctreeCode.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+	constexpr char BINARY_CODE_MAGIC[4] = {'M', 'O', 'C', 'T'};
+	constexpr uint8_t BINARY_CODE_VERSION = 1;
+
+	// Walks a preorder code with one counter of children still owed per open GREY node
+	class PreorderCursor
+	{
+	public:
+		// Returns how many GREY nodes this node completes, i.e. the ')' that follow it
+		size_t push(NodeCode node)
+		{
+			if(!pending.empty())
+			{
+				--pending.back();
+			}
+			else if(bStarted)
+			{
+				throw std::invalid_argument("octree code has nodes past the root's subtree");
+			}
+			bStarted = true;
+
+			if(node == GREY)
+			{
+				pending.push_back(8);
+				maxDepth = std::max(maxDepth, pending.size());
+				return 0;
+			}
+
+			size_t closed = 0;
+			while(!pending.empty() && pending.back() == 0)
+			{
+				pending.pop_back();
+				++closed;
+			}
+			return closed;
+		}
+
+		bool isComplete() const { return bStarted && pending.empty(); }
+		size_t getMaxDepth() const { return maxDepth; }
+
+	private:
+		std::vector<uint8_t> pending;
+		size_t maxDepth = 0;
+		bool bStarted = false;
+	};
+
+	void setMaxDepth(BinaryOctreeCode& code, size_t maxDepth)
+	{
+		if(maxDepth > 255)
+		{
+			throw std::invalid_argument("octree code is deeper than 255 levels");
+		}
+		code.maxDepth = static_cast<uint8_t>(maxDepth);
+	}
+
+	void encodeNode(const OctreeNode& node, BinaryOctreeCode& code, size_t depth, size_t& maxDepth)
+	{
+		maxDepth = std::max(maxDepth, depth);
+		appendBinaryCodeNode(code, node.code);
+		if(node.code == GREY)
+		{
+			for(const OctreeNode* child : node.children)
+			{
+				encodeNode(*child, code, depth + 1, maxDepth);
+			}
+		}
+	}
+
+	// The header is written field by field so the file does not depend on struct padding
+	template<typename T>
+	void putValue(std::vector<char>& header, const T& value)
+	{
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		header.insert(header.end(), bytes, bytes + sizeof(T));
+	}
+
+	template<typename T>
+	T getValue(const char*& cursor)
+	{
+		T value;
+		std::memcpy(&value, cursor, sizeof(T));
+		cursor += sizeof(T);
+		return value;
+	}
+}
+
+void appendBinaryCodeNode(BinaryOctreeCode& code, NodeCode node)
+{
+	if((code.nodeCount & 3) == 0)
+	{
+		code.bits.push_back(0);
+	}
+	code.bits.back() |= static_cast<uint8_t>(node << ((code.nodeCount & 3) * 2));
+	++code.nodeCount;
+}
+
+BinaryOctreeCode encodeBinaryCode(const std::string& code, glm::vec3 posMin, glm::vec3 posMax)
+{
+	BinaryOctreeCode binary;
+	binary.posMin = posMin;
+	binary.posMax = posMax;
+	binary.bits.reserve(code.size() / 4 + 1);
+
+	PreorderCursor cursor;
+	size_t owedParens = 0;
+	for(const char symbol : code)
+	{
+		if(symbol == ')')
+		{
+			if(owedParens == 0)
+			{
+				throw std::invalid_argument("unbalanced ')' in octree code");
+			}
+			--owedParens;
+			continue;
+		}
+
+		NodeCode node;
+		switch(symbol)
+		{
+		case 'W': node = WHITE; break;
+		case 'B': node = BLACK; break;
+		case '(': node = GREY; break;
+		default: throw std::invalid_argument(std::string("unexpected octree code symbol '") + symbol + "'");
+		}
+		if(owedParens != 0)
+		{
+			throw std::invalid_argument("missing ')' in octree code");
+		}
+		owedParens = cursor.push(node);
+		appendBinaryCodeNode(binary, node);
+	}
+
+	if(!cursor.isComplete() || owedParens != 0)
+	{
+		throw std::invalid_argument("octree code ends inside a GREY node");
+	}
+	setMaxDepth(binary, cursor.getMaxDepth());
+	return binary;
+}
+
+BinaryOctreeCode encodeBinaryCode(const OctreeNode& root)
+{
+	BinaryOctreeCode binary;
+	binary.posMin = root.posMin.pos;
+	binary.posMax = root.posMax.pos;
+
+	size_t maxDepth = 0;
+	encodeNode(root, binary, 0, maxDepth);
+	setMaxDepth(binary, maxDepth);
+	return binary;
+}
+
+BinaryOctreeCode encodeBinaryCode(const Octree& tree)
+{
+	BinaryOctreeCode binary = encodeBinaryCode(*tree.root);
+	getOctreeBounds(tree, binary.posMin, binary.posMax);
+	return binary;
+}
+
+std::string decodeBinaryCode(const BinaryOctreeCode& code)
+{
+	static constexpr char NODE_SYMBOLS[4] = {'W', 'B', '(', '?'};
+
+	std::string text;
+	text.reserve(code.nodeCount * 5 / 4 + 1);
+
+	PreorderCursor cursor;
+	for(uint64_t i = 0; i < code.nodeCount; ++i)
+	{
+		const NodeCode node = getBinaryCodeNode(code, i);
+		if(node > GREY)
+		{
+			throw std::invalid_argument("binary octree code holds an invalid node");
+		}
+		text += NODE_SYMBOLS[node];
+		text.append(cursor.push(node), ')');
+	}
+
+	if(!cursor.isComplete())
+	{
+		throw std::invalid_argument("binary octree code ends inside a GREY node");
+	}
+	return text;
+}
+
+OctreeNode buildTreeFromBinaryCode(const BinaryOctreeCode& code, OctreeArena& arena)
+{
+	if(code.nodeCount == 0)
+	{
+		throw std::invalid_argument("binary octree code is empty");
+	}
+
+	OctreeNode root{};
+	root.posMin.pos = code.posMin;
+	root.posMax.pos = code.posMax;
+
+	// Every open GREY node with the index of its next child to fill
+	std::vector<std::pair<OctreeNode*, int>> stack;
+	stack.reserve(code.maxDepth + 1);
+
+	for(uint64_t i = 0; i < code.nodeCount; ++i)
+	{
+		OctreeNode* node = &root;
+		if(i > 0)
+		{
+			if(stack.empty())
+			{
+				throw std::invalid_argument("binary octree code has nodes past the root's subtree");
+			}
+			node = stack.back().first->children[stack.back().second++];
+		}
+
+		node->code = getBinaryCodeNode(code, i);
+		if(node->code == GREY)
+		{
+			subdivide(*node, arena);
+			stack.emplace_back(node, 0);
+			continue;
+		}
+		if(node->code != WHITE && node->code != BLACK)
+		{
+			throw std::invalid_argument("binary octree code holds an invalid node");
+		}
+
+		// A leaf may finish its parent, and that parent its own
+		updateAggregates(*node);
+		while(!stack.empty() && stack.back().second == 8)
+		{
+			updateAggregates(*stack.back().first);
+			stack.pop_back();
+		}
+	}
+
+	if(!stack.empty())
+	{
+		throw std::invalid_argument("binary octree code ends inside a GREY node");
+	}
+	return root;
+}
+
+void writeBinaryCode(const BinaryOctreeCode& code, const std::string& path)
+{
+	std::vector<char> header(BINARY_CODE_MAGIC, BINARY_CODE_MAGIC + 4);
+	putValue(header, BINARY_CODE_VERSION);
+	putValue(header, code.maxDepth);
+	putValue(header, uint16_t(0));
+	putValue(header, code.posMin);
+	putValue(header, code.posMax);
+	putValue(header, code.nodeCount);
+
+	std::ofstream file(path, std::ios_base::out | std::ios_base::binary);
+	if(!file)
+	{
+		throw std::runtime_error("failed to open " + path + " for writing");
+	}
+	file.write(header.data(), static_cast<std::streamsize>(header.size()));
+	file.write(reinterpret_cast<const char*>(code.bits.data()), static_cast<std::streamsize>(code.bits.size()));
+	if(!file)
+	{
+		throw std::runtime_error("failed to write " + path);
+	}
+}
+
+void readBinaryCodeHeader(const char* data, size_t size, BinaryOctreeCode& code)
+{
+	if(size < BINARY_CODE_HEADER_SIZE || std::memcmp(data, BINARY_CODE_MAGIC, 4) != 0)
+	{
+		throw std::runtime_error("not a binary octree code");
+	}
+
+	const char* cursor = data + 4;
+	if(getValue<uint8_t>(cursor) != BINARY_CODE_VERSION)
+	{
+		throw std::runtime_error("unsupported binary octree code version");
+	}
+
+	code.maxDepth = getValue<uint8_t>(cursor);
+	getValue<uint16_t>(cursor);
+	code.posMin = getValue<glm::vec3>(cursor);
+	code.posMax = getValue<glm::vec3>(cursor);
+	code.nodeCount = getValue<uint64_t>(cursor);
+}
+
+BinaryOctreeCode readBinaryCode(const std::string& path)
+{
+	std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+	if(!file)
+	{
+		throw std::runtime_error("failed to open " + path);
+	}
+
+	char header[BINARY_CODE_HEADER_SIZE];
+	BinaryOctreeCode code;
+	try
+	{
+		readBinaryCodeHeader(header, file.read(header, sizeof(header)) ? sizeof(header) : 0, code);
+	}
+	catch(const std::runtime_error& error)
+	{
+		throw std::runtime_error(path + ": " + error.what());
+	}
+
+	code.bits.resize((code.nodeCount + 3) / 4);
+	if(!file.read(reinterpret_cast<char*>(code.bits.data()), static_cast<std::streamsize>(code.bits.size())))
+	{
+		throw std::runtime_error(path + " is truncated");
+	}
+	return code;
+}
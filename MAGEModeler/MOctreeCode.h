@@ -0,0 +1,50 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MOctree.h"
+
+/*
+ * Packed octree code. Same preorder as the text code, but every node is two bits
+ * holding its NodeCode (WHITE = 0, BLACK = 1, GREY = 2), four nodes per byte with the
+ * first one in the low bits. A GREY node stands for '(' and its ')' is implied by its
+ * eight children, so a tree costs about a quarter of its text code.
+ */
+struct BinaryOctreeCode
+{
+	glm::vec3 posMin{};
+	glm::vec3 posMax{};
+	// Level of the deepest leaf, 0 when the root is a leaf. Merged codes may overstate it
+	uint8_t maxDepth = 0;
+	uint64_t nodeCount = 0;
+	std::vector<uint8_t> bits;
+};
+
+inline NodeCode getBinaryCodeNode(const BinaryOctreeCode& code, uint64_t node)
+{
+	return static_cast<NodeCode>((code.bits[node >> 2] >> ((node & 3) * 2)) & 3);
+}
+
+void appendBinaryCodeNode(BinaryOctreeCode& code, NodeCode node);
+
+// Lossless both ways; encoding throws std::invalid_argument on a malformed text code
+BinaryOctreeCode encodeBinaryCode(const std::string& code, glm::vec3 posMin = glm::vec3(-5.0f, -5.0f, -5.0f), glm::vec3 posMax = glm::vec3(5.0f, 5.0f, 5.0f));
+BinaryOctreeCode encodeBinaryCode(const OctreeNode& root);
+// The header gets the world box, the transform is baked into it
+BinaryOctreeCode encodeBinaryCode(const Octree& tree);
+std::string decodeBinaryCode(const BinaryOctreeCode& code);
+
+OctreeNode buildTreeFromBinaryCode(const BinaryOctreeCode& code, OctreeArena& arena);
+
+/*
+ * File layout, little endian: "MOCT", version byte, maxDepth byte, two reserved bytes,
+ * posMin and posMax as six floats, nodeCount as uint64, then the packed nodes.
+ * Both throw std::runtime_error on I/O errors or a bad header.
+ */
+void writeBinaryCode(const BinaryOctreeCode& code, const std::string& path);
+BinaryOctreeCode readBinaryCode(const std::string& path);
+
+constexpr size_t BINARY_CODE_HEADER_SIZE = 40;
+
+// Fills everything but bits from the first BINARY_CODE_HEADER_SIZE bytes of data
+void readBinaryCodeHeader(const char* data, size_t size, BinaryOctreeCode& code);
@@ -0,0 +1,244 @@
+﻿#include "MOctreeStream.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MMappedFile::MMappedFile(const std::string& path)
+{
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("failed to open " + path);
+	}
+
+	LARGE_INTEGER fileSize{};
+	if(!GetFileSizeEx(file, &fileSize))
+	{
+		CloseHandle(file);
+		throw std::runtime_error("failed to stat " + path);
+	}
+
+	// An empty file cannot be mapped and needs no mapping
+	mappedSize = static_cast<size_t>(fileSize.QuadPart);
+	if(mappedSize == 0)
+	{
+		CloseHandle(file);
+		return;
+	}
+
+	// The view keeps the mapping and the file alive on its own
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if(!mapping)
+	{
+		throw std::runtime_error("failed to map " + path);
+	}
+
+	mappedData = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	CloseHandle(mapping);
+	if(!mappedData)
+	{
+		throw std::runtime_error("failed to map " + path);
+	}
+}
+
+MMappedFile::~MMappedFile()
+{
+	if(mappedData)
+	{
+		UnmapViewOfFile(mappedData);
+	}
+}
+
+#else
+
+MMappedFile::MMappedFile(const std::string& path)
+{
+	const int file = open(path.c_str(), O_RDONLY);
+	if(file < 0)
+	{
+		throw std::runtime_error("failed to open " + path);
+	}
+
+	struct stat fileStat{};
+	if(fstat(file, &fileStat) != 0)
+	{
+		close(file);
+		throw std::runtime_error("failed to stat " + path);
+	}
+
+	mappedSize = static_cast<size_t>(fileStat.st_size);
+	if(mappedSize == 0)
+	{
+		close(file);
+		return;
+	}
+
+	void* view = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if(view == MAP_FAILED)
+	{
+		throw std::runtime_error("failed to map " + path);
+	}
+
+	madvise(view, mappedSize, MADV_SEQUENTIAL);
+	mappedData = static_cast<const char*>(view);
+}
+
+MMappedFile::~MMappedFile()
+{
+	if(mappedData)
+	{
+		munmap(const_cast<char*>(mappedData), mappedSize);
+	}
+}
+
+#endif
+
+float getOctreeVolume(const MMappedFile& file, glm::vec3 posMin, glm::vec3 posMax)
+{
+	VolumeConsumer consumer;
+	streamOctreeFile(file, posMin, posMax, consumer);
+	return static_cast<float>(consumer.volume);
+}
+
+void populateFromOctree(const MMappedFile& file, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex, glm::vec3 posMin, glm::vec3 posMax)
+{
+	MeshConsumer consumer{vertices, indices, currentIndex};
+	streamOctreeFile(file, posMin, posMax, consumer);
+}
+
+OctreeNode buildTreeFromCode(const MMappedFile& file, OctreeArena& arena, glm::vec3 posMin, glm::vec3 posMax)
+{
+	TreeConsumer consumer{arena};
+	streamOctreeFile(file, posMin, posMax, consumer);
+	consumer.finish();
+	return consumer.root;
+}
+
+void buildCodeFromBooleanOperation(const std::string& codeA, const std::string& codeB, const Operation& operation, std::string& code)
+{
+	TextCodeReader readerA{codeA.data(), codeA.data() + codeA.size()};
+	TextCodeReader readerB{codeB.data(), codeB.data() + codeB.size()};
+	TextCodeWriter writer{code};
+	mergeOctreeCodes(readerA, readerB, operation, writer);
+}
+
+void buildCodeFromBooleanOperation(const MMappedFile& fileA, const MMappedFile& fileB, const Operation& operation, BinaryOctreeCode& code)
+{
+	code = BinaryOctreeCode{};
+	BinaryCodeWriter writer{code};
+	withOctreeFileReader(fileA, glm::vec3(-5.0f, -5.0f, -5.0f), glm::vec3(5.0f, 5.0f, 5.0f), [&](auto& readerA, const glm::vec3& posMin, const glm::vec3& posMax)
+	{
+		code.posMin = posMin;
+		code.posMax = posMax;
+		withOctreeFileReader(fileB, posMin, posMax, [&](auto& readerB, const glm::vec3&, const glm::vec3&)
+		{
+			mergeOctreeCodes(readerA, readerB, operation, writer);
+		});
+	});
+}
+
+OctreeSymmetry makeOctreeRotation(int axis, int quarterTurns)
+{
+	if(axis < 0 || axis > 2)
+	{
+		throw std::invalid_argument("octree rotation axis must be 0, 1 or 2");
+	}
+
+	// One quarter turn takes (u, v) to (-v, u) on the other two axes
+	const int u = (axis + 1) % 3;
+	const int v = (axis + 2) % 3;
+	OctreeSymmetry quarterTurn;
+	quarterTurn.axes[u] = static_cast<uint8_t>(v);
+	quarterTurn.flips[u] = true;
+	quarterTurn.axes[v] = static_cast<uint8_t>(u);
+
+	OctreeSymmetry rotation;
+	for(int turn = ((quarterTurns % 4) + 4) % 4; turn > 0; --turn)
+	{
+		rotation = combineOctreeSymmetries(rotation, quarterTurn);
+	}
+	return rotation;
+}
+
+OctreeSymmetry makeOctreeMirror(int axis)
+{
+	if(axis < 0 || axis > 2)
+	{
+		throw std::invalid_argument("octree mirror axis must be 0, 1 or 2");
+	}
+	OctreeSymmetry mirror;
+	mirror.flips[axis] = true;
+	return mirror;
+}
+
+OctreeSymmetry combineOctreeSymmetries(const OctreeSymmetry& first, const OctreeSymmetry& second)
+{
+	OctreeSymmetry combined;
+	for(int k = 0; k < 3; ++k)
+	{
+		combined.axes[k] = first.axes[second.axes[k]];
+		combined.flips[k] = second.flips[k] != first.flips[second.axes[k]];
+	}
+	return combined;
+}
+
+std::string transformOctreeCode(const std::string& code, const OctreeSymmetry& symmetry)
+{
+	std::string transformed;
+	transformed.reserve(code.size());
+	TextCodeReader reader{code.data(), code.data() + code.size()};
+	TextCodeWriter writer{transformed};
+	permuteOctreeCode(reader, symmetry, writer);
+	return transformed;
+}
+
+void transformOctreeBounds(const OctreeSymmetry& symmetry, glm::vec3& posMin, glm::vec3& posMax)
+{
+	const glm::vec3 center = (posMin + posMax) / 2.0f;
+	const glm::vec3 halfSize = (posMax - posMin) / 2.0f;
+	for(int k = 0; k < 3; ++k)
+	{
+		posMin[k] = center[k] - halfSize[symmetry.axes[k]];
+		posMax[k] = center[k] + halfSize[symmetry.axes[k]];
+	}
+}
+
+BinaryOctreeCode transformOctreeCode(const BinaryOctreeCode& code, const OctreeSymmetry& symmetry)
+{
+	BinaryOctreeCode transformed;
+	transformed.posMin = code.posMin;
+	transformed.posMax = code.posMax;
+	transformOctreeBounds(symmetry, transformed.posMin, transformed.posMax);
+	transformed.bits.reserve(code.bits.size());
+
+	BinaryCodeReader reader{code.bits.data(), code.nodeCount};
+	BinaryCodeWriter writer{transformed};
+	permuteOctreeCode(reader, symmetry, writer);
+	return transformed;
+}
+
+void transformOctreeCode(const MMappedFile& file, const OctreeSymmetry& symmetry, BinaryOctreeCode& code)
+{
+	code = BinaryOctreeCode{};
+	BinaryCodeWriter writer{code};
+	withOctreeFileReader(file, glm::vec3(-5.0f, -5.0f, -5.0f), glm::vec3(5.0f, 5.0f, 5.0f), [&](auto& reader, const glm::vec3& posMin, const glm::vec3& posMax)
+	{
+		code.posMin = posMin;
+		code.posMax = posMax;
+		transformOctreeBounds(symmetry, code.posMin, code.posMax);
+		permuteOctreeCode(reader, symmetry, writer);
+	});
+}
@@ -0,0 +1,520 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "MOctree.h"
+#include "MOctreeCode.h"
+
+/*
+ * Read-only view of a whole file through the OS page cache (CreateFileMapping on
+ * Windows, mmap elsewhere). Pages are faulted in on first touch and hinted for a
+ * sequential scan, so a decoder can start on a multi-GB code before it has been read.
+ */
+class MMappedFile
+{
+public:
+	// Throws std::runtime_error when the file cannot be opened or mapped
+	explicit MMappedFile(const std::string& path);
+	~MMappedFile();
+	MMappedFile(const MMappedFile&) = delete;
+	MMappedFile& operator=(const MMappedFile&) = delete;
+
+	const char* data() const { return mappedData; }
+	size_t size() const { return mappedSize; }
+
+private:
+	const char* mappedData = nullptr;
+	size_t mappedSize = 0;
+};
+
+/*
+ * Node sources for streamOctreeCode(). next() hands out the NodeCode of every node in
+ * preorder and returns false once the input is exhausted.
+ */
+struct TextCodeReader
+{
+	const char* cursor;
+	const char* end;
+
+	// A line break ends the code, as getInputCode() reads a single line
+	bool next(NodeCode& node)
+	{
+		for(; cursor != end; ++cursor)
+		{
+			switch(*cursor)
+			{
+			case ')': continue;
+			case 'W': node = WHITE; ++cursor; return true;
+			case 'B': node = BLACK; ++cursor; return true;
+			case '(': node = GREY; ++cursor; return true;
+			case '\r':
+			case '\n': cursor = end; return false;
+			default: throw std::invalid_argument(std::string("unexpected octree code symbol '") + *cursor + "'");
+			}
+		}
+		return false;
+	}
+};
+
+struct BinaryCodeReader
+{
+	const uint8_t* bits;
+	uint64_t nodeCount;
+	uint64_t index = 0;
+
+	bool next(NodeCode& node)
+	{
+		if(index == nodeCount)
+		{
+			return false;
+		}
+		node = static_cast<NodeCode>((bits[index >> 2] >> ((index & 3) * 2)) & 3);
+		++index;
+		if(node > GREY)
+		{
+			throw std::invalid_argument("binary octree code holds an invalid node");
+		}
+		return true;
+	}
+};
+
+/*
+ * Decodes one tree from reader with an explicit stack, one frame per open GREY node,
+ * and calls consumer.visit(code, posMin, posMax, level) for every node in preorder.
+ * Working memory is O(depth) besides what the consumer keeps.
+ */
+template<typename Reader, typename Consumer>
+void streamOctreeCode(Reader& reader, const glm::vec3& posMin, const glm::vec3& posMax, Consumer& consumer)
+{
+	struct Frame
+	{
+		glm::vec3 posMin;
+		glm::vec3 childSize;
+		int nextChild;
+	};
+	std::vector<Frame> stack;
+
+	glm::vec3 nodeMin = posMin;
+	glm::vec3 nodeSize = posMax - posMin;
+	for(;;)
+	{
+		NodeCode node;
+		if(!reader.next(node))
+		{
+			throw std::invalid_argument("octree code ends inside a GREY node");
+		}
+		consumer.visit(node, nodeMin, nodeMin + nodeSize, stack.size());
+
+		if(node == GREY)
+		{
+			stack.push_back({nodeMin, nodeSize / 2.0f, 0});
+		}
+		else
+		{
+			while(!stack.empty() && stack.back().nextChild == 8)
+			{
+				stack.pop_back();
+			}
+		}
+
+		if(stack.empty())
+		{
+			return;
+		}
+
+		Frame& parent = stack.back();
+		const int i = parent.nextChild++;
+		nodeMin = parent.posMin + glm::vec3(i % 2, (i / 2) % 2, i / 4) * parent.childSize;
+		nodeSize = parent.childSize;
+	}
+}
+
+// Calls f(reader, posMin, posMax) with a reader for a text or binary code file, told apart
+// by the binary header. A binary code brings its own bounds
+template<typename F>
+void withOctreeFileReader(const MMappedFile& file, const glm::vec3& posMin, const glm::vec3& posMax, F&& f)
+{
+	if(file.size() >= BINARY_CODE_HEADER_SIZE && file.data()[0] == 'M')
+	{
+		BinaryOctreeCode header;
+		readBinaryCodeHeader(file.data(), file.size(), header);
+		if(file.size() - BINARY_CODE_HEADER_SIZE < (header.nodeCount + 3) / 4)
+		{
+			throw std::runtime_error("binary octree code is truncated");
+		}
+
+		BinaryCodeReader reader{reinterpret_cast<const uint8_t*>(file.data() + BINARY_CODE_HEADER_SIZE), header.nodeCount};
+		f(reader, header.posMin, header.posMax);
+	}
+	else
+	{
+		TextCodeReader reader{file.data(), file.data() + file.size()};
+		f(reader, posMin, posMax);
+	}
+}
+
+template<typename Consumer>
+void streamOctreeFile(const MMappedFile& file, const glm::vec3& posMin, const glm::vec3& posMax, Consumer& consumer)
+{
+	withOctreeFileReader(file, posMin, posMax, [&](auto& reader, const glm::vec3& readerMin, const glm::vec3& readerMax)
+	{
+		streamOctreeCode(reader, readerMin, readerMax, consumer);
+	});
+}
+
+struct VolumeConsumer
+{
+	double volume = 0.0;
+
+	void visit(NodeCode node, const glm::vec3& posMin, const glm::vec3& posMax, size_t)
+	{
+		if(node == BLACK)
+		{
+			const glm::vec3 size = posMax - posMin;
+			volume += double(size.x) * size.y * size.z;
+		}
+	}
+};
+
+struct MeshConsumer
+{
+	std::vector<Vertex>& vertices;
+	std::vector<uint32_t>& indices;
+	uint32_t& currentIndex;
+
+	void visit(NodeCode node, const glm::vec3& posMin, const glm::vec3& posMax, size_t)
+	{
+		if(node == BLACK)
+		{
+			appendCube(posMin, posMax, vertices, indices, currentIndex);
+		}
+	}
+};
+
+// Rebuilds the tree into arena while the code is still being read; call finish() once it is done
+struct TreeConsumer
+{
+	OctreeArena& arena;
+	OctreeNode root{};
+	// Every open GREY node with the index of its next child
+	std::vector<std::pair<OctreeNode*, int>> open;
+
+	void visit(NodeCode node, const glm::vec3& posMin, const glm::vec3& posMax, size_t level)
+	{
+		OctreeNode* target = &root;
+		if(level == 0)
+		{
+			root.posMin.pos = posMin;
+			root.posMax.pos = posMax;
+		}
+		else
+		{
+			closeAbove(level);
+			target = open.back().first->children[open.back().second++];
+		}
+
+		target->code = node;
+		if(node == GREY)
+		{
+			subdivide(*target, arena);
+			open.emplace_back(target, 0);
+		}
+		else
+		{
+			updateAggregates(*target);
+		}
+	}
+
+	void finish() { closeAbove(0); }
+
+private:
+	// GREY nodes deeper than level have all their children by now
+	void closeAbove(size_t level)
+	{
+		while(open.size() > level)
+		{
+			updateAggregates(*open.back().first);
+			open.pop_back();
+		}
+	}
+};
+
+/*
+ * Result sinks for mergeOctreeCodes(). write() gets every node in preorder with its
+ * level, close() ends the last open GREY node and collapse() replaces the last GREY
+ * node and its eight leaf children with one leaf.
+ */
+struct TextCodeWriter
+{
+	std::string& code;
+
+	void write(NodeCode node, size_t) { code += node == GREY ? '(' : node == BLACK ? 'B' : 'W'; }
+	void close() { code += ')'; }
+	void collapse(NodeCode leaf)
+	{
+		code.resize(code.size() - 9);
+		write(leaf, 0);
+	}
+};
+
+struct BinaryCodeWriter
+{
+	BinaryOctreeCode& code;
+
+	void write(NodeCode node, size_t level)
+	{
+		appendBinaryCodeNode(code, node);
+		if(node != GREY && level > code.maxDepth)
+		{
+			code.maxDepth = static_cast<uint8_t>(level);
+		}
+	}
+	void close() {}
+	void collapse(NodeCode leaf)
+	{
+		code.nodeCount -= 9;
+		code.bits.resize((code.nodeCount + 3) / 4);
+		if(code.nodeCount & 3)
+		{
+			code.bits.back() &= static_cast<uint8_t>((1u << ((code.nodeCount & 3) * 2)) - 1);
+		}
+		appendBinaryCodeNode(code, leaf);
+	}
+};
+
+// Reads one whole subtree whose root has already been read, writing it out unless writer is null
+template<typename Reader, typename Writer>
+void copyOctreeSubtree(Reader& reader, NodeCode root, size_t level, Writer* writer, bool bComplement)
+{
+	if(writer)
+	{
+		writer->write(root, level);
+	}
+	if(root != GREY)
+	{
+		return;
+	}
+
+	// Children still owed per open GREY node
+	std::vector<int> pending(1, 8);
+	while(!pending.empty())
+	{
+		NodeCode node;
+		if(!reader.next(node))
+		{
+			throw std::invalid_argument("octree code ends inside a GREY node");
+		}
+		--pending.back();
+
+		if(writer)
+		{
+			writer->write(bComplement && node != GREY ? (node == BLACK ? WHITE : BLACK) : node, level + pending.size());
+		}
+		if(node == GREY)
+		{
+			pending.push_back(8);
+			continue;
+		}
+
+		while(!pending.empty() && pending.back() == 0)
+		{
+			pending.pop_back();
+			if(writer)
+			{
+				writer->close();
+			}
+		}
+	}
+}
+
+/*
+ * Boolean operation on two codes read in lockstep, written straight to writer. Where
+ * one side is a leaf the other side's subtree is skipped or copied through without
+ * being paired, and GREY nodes whose eight children come out as one color collapse.
+ * Both codes are taken in the same root box. Working memory is O(depth).
+ */
+template<typename ReaderA, typename ReaderB, typename Writer>
+void mergeOctreeCodes(ReaderA& readerA, ReaderB& readerB, const Operation& operation, Writer& writer)
+{
+	struct Frame
+	{
+		int remaining;
+		int blackChildren;
+		int whiteChildren;
+	};
+	std::vector<Frame> stack;
+
+	do
+	{
+		NodeCode a;
+		NodeCode b;
+		if(!readerA.next(a) || !readerB.next(b))
+		{
+			throw std::invalid_argument("octree code ends inside a GREY node");
+		}
+
+		const size_t level = stack.size();
+		NodeCode result = decideBooleanOperation(a, b, operation);
+		if(a == GREY && b == GREY)
+		{
+			writer.write(GREY, level);
+			stack.push_back({8, 0, 0});
+			continue;
+		}
+
+		if(result != GREY)
+		{
+			writer.write(result, level);
+			copyOctreeSubtree(readerA, a, level, static_cast<Writer*>(nullptr), false);
+			copyOctreeSubtree(readerB, b, level, static_cast<Writer*>(nullptr), false);
+		}
+		else if(a != GREY)
+		{
+			// Only a BLACK minuend leaves DIFFERENCE undecided, and it keeps what b does not cover
+			copyOctreeSubtree(readerB, b, level, &writer, operation == DIFFERENCE);
+		}
+		else
+		{
+			copyOctreeSubtree(readerA, a, level, &writer, false);
+		}
+
+		// A finished node completes its parent's children, which may complete the parent
+		while(!stack.empty())
+		{
+			Frame& parent = stack.back();
+			--parent.remaining;
+			parent.blackChildren += result == BLACK;
+			parent.whiteChildren += result == WHITE;
+			if(parent.remaining > 0)
+			{
+				break;
+			}
+
+			if(parent.blackChildren == 8 || parent.whiteChildren == 8)
+			{
+				result = parent.blackChildren == 8 ? BLACK : WHITE;
+				writer.collapse(result);
+			}
+			else
+			{
+				result = GREY;
+				writer.close();
+			}
+			stack.pop_back();
+		}
+	} while(!stack.empty());
+}
+
+/*
+ * Rotation by quarter turns or mirror of the root box about its center. Output axis k
+ * is input axis axes[k], reversed when flips[k]; that maps octants onto octants, so at
+ * every level it is the same permutation of the eight child slots.
+ */
+struct OctreeSymmetry
+{
+	std::array<uint8_t, 3> axes{0, 1, 2};
+	std::array<bool, 3> flips{};
+
+	// The input child slot that ends up in slot i
+	int getSourceSlot(int i) const
+	{
+		int source = 0;
+		for(int k = 0; k < 3; ++k)
+		{
+			source |= (((i >> k) & 1) ^ int(flips[k])) << axes[k];
+		}
+		return source;
+	}
+};
+
+// Counterclockwise looking down the axis (0 = x, 1 = y, 2 = z); both throw std::invalid_argument on any other axis
+OctreeSymmetry makeOctreeRotation(int axis, int quarterTurns);
+OctreeSymmetry makeOctreeMirror(int axis);
+// first, then second
+OctreeSymmetry combineOctreeSymmetries(const OctreeSymmetry& first, const OctreeSymmetry& second);
+// Turns a root box about its center; the half extents trade places
+void transformOctreeBounds(const OctreeSymmetry& symmetry, glm::vec3& posMin, glm::vec3& posMax);
+
+/*
+ * Rewrites the code read from reader under symmetry, leaving reader past the tree. Readers
+ * are cursors into memory, so opening a GREY node copies one per child and skips each
+ * child's subtree to place the next; children are then read in permuted order straight
+ * from the input. Working memory is eight cursors per level, and every level of the tree
+ * costs one more sequential scan of the input.
+ */
+template<typename Reader, typename Writer>
+void permuteOctreeCode(Reader& reader, const OctreeSymmetry& symmetry, Writer& writer)
+{
+	int sourceSlots[8];
+	for(int i = 0; i < 8; ++i)
+	{
+		sourceSlots[i] = symmetry.getSourceSlot(i);
+	}
+
+	struct Frame
+	{
+		Reader children[8];
+		int nextChild;
+	};
+	std::vector<Frame> stack;
+	// Pushes a frame with a cursor on each child of the GREY node before cursor; cursor ends past its subtree
+	auto open = [&](Reader& cursor)
+	{
+		Frame frame;
+		frame.nextChild = 0;
+		for(Reader& child : frame.children)
+		{
+			child = cursor;
+			NodeCode node;
+			if(!cursor.next(node))
+			{
+				throw std::invalid_argument("octree code ends inside a GREY node");
+			}
+			copyOctreeSubtree(cursor, node, 0, static_cast<Writer*>(nullptr), false);
+		}
+		stack.push_back(frame);
+	};
+
+	NodeCode root;
+	if(!reader.next(root))
+	{
+		throw std::invalid_argument("octree code ends inside a GREY node");
+	}
+	writer.write(root, 0);
+	if(root == GREY)
+	{
+		open(reader);
+	}
+	while(!stack.empty())
+	{
+		Frame& parent = stack.back();
+		if(parent.nextChild == 8)
+		{
+			writer.close();
+			stack.pop_back();
+			continue;
+		}
+
+		Reader child = parent.children[sourceSlots[parent.nextChild++]];
+		NodeCode node;
+		child.next(node);
+		writer.write(node, stack.size());
+		if(node == GREY)
+		{
+			open(child);
+		}
+	}
+}
+
+float getOctreeVolume(const MMappedFile& file, glm::vec3 posMin = glm::vec3(-5.0f, -5.0f, -5.0f), glm::vec3 posMax = glm::vec3(5.0f, 5.0f, 5.0f));
+void populateFromOctree(const MMappedFile& file, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, uint32_t& currentIndex, glm::vec3 posMin = glm::vec3(-5.0f, -5.0f, -5.0f), glm::vec3 posMax = glm::vec3(5.0f, 5.0f, 5.0f));
+OctreeNode buildTreeFromCode(const MMappedFile& file, OctreeArena& arena, glm::vec3 posMin = glm::vec3(-5.0f, -5.0f, -5.0f), glm::vec3 posMax = glm::vec3(5.0f, 5.0f, 5.0f));
+// Text codes in, text code out; file codes may be text or binary, the result takes fileA's box
+void buildCodeFromBooleanOperation(const std::string& codeA, const std::string& codeB, const Operation& operation, std::string& code);
+void buildCodeFromBooleanOperation(const MMappedFile& fileA, const MMappedFile& fileB, const Operation& operation, BinaryOctreeCode& code);
+// Binary codes get their box rotated or mirrored about its center too
+std::string transformOctreeCode(const std::string& code, const OctreeSymmetry& symmetry);
+BinaryOctreeCode transformOctreeCode(const BinaryOctreeCode& code, const OctreeSymmetry& symmetry);
+void transformOctreeCode(const MMappedFile& file, const OctreeSymmetry& symmetry, BinaryOctreeCode& code);
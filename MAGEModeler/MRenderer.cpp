@@ -17,6 +17,46 @@ void MRenderer::run(std::vector<Vertex>& inVertices, std::vector<uint32_t>& inIn
 	cleanup();
 }
 
+void MRenderer::run(std::vector<Vertex>& inVertices, std::vector<uint16_t>& inIndices)
+{
+	vertices = inVertices;
+	shortIndices = inIndices;
+	indexType = VK_INDEX_TYPE_UINT16;
+	initWindow();
+	initVulkan();
+	mainLoop();
+	cleanup();
+}
+
+void MRenderer::run(std::vector<Vertex>& inVertices, std::vector<uint32_t>& inIndices, std::vector<CubeInstance>& inInstances, const glm::vec3& inCubeRootExtent)
+{
+	vertices = inVertices;
+	indices = inIndices;
+	cubeInstances = inInstances;
+	cubeRootExtent = inCubeRootExtent;
+	initWindow();
+	initVulkan();
+	mainLoop();
+	cleanup();
+}
+
+void MRenderer::run(std::vector<Vertex>& inVertices, std::vector<uint32_t>& inIndices, const Octree& inTree)
+{
+	vertices = inVertices;
+	indices = inIndices;
+	lodTree = &inTree;
+	cubeRootExtent = getCubeRootExtent(inTree);
+	initWindow();
+	initVulkan();
+	mainLoop();
+	cleanup();
+}
+
+void MRenderer::setMeshChunks(ChunkedMesh inChunks)
+{
+	meshChunks = std::move(inChunks);
+}
+
 bool MRenderer::checkValidationLayerSupport()
 {
 	uint32_t layerCount;
@@ -106,6 +146,8 @@ void MRenderer::initVulkan()
 	//loadModel();
 	createVertexBuffer();
 	createIndexBuffer();
+	createCubeBuffers();
+	createChunkDrawBuffers();
 	createUniformBuffers();
 	createDescriptorPool();
 	createDescriptorSets();
@@ -460,23 +502,12 @@ void MRenderer::createDescriptorSetLayout()
 
 void MRenderer::createIndexBuffer()
 {
-	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), (size_t)bufferSize);
-	vkUnmapMemory(device, stagingBufferMemory);
-
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+	const bool bShortIndices = indexType == VK_INDEX_TYPE_UINT16;
+	VkDeviceSize bufferSize = bShortIndices ? sizeof(shortIndices[0]) * shortIndices.size() : sizeof(indices[0]) * indices.size();
+	const void* indexData = bShortIndices ? static_cast<const void*>(shortIndices.data()) : static_cast<const void*>(indices.data());
+	if(bufferSize == 0) return;
 
-	copyBuffer(stagingBuffer, indexBuffer, bufferSize);
-
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+	createStagedBuffer(indexData, bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
 }
 
 void MRenderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
@@ -510,6 +541,13 @@ void MRenderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemo
 void MRenderer::createVertexBuffer()
 {
 	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+	if(bufferSize == 0) return;
+
+	createStagedBuffer(vertices.data(), bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+}
+
+void MRenderer::createStagedBuffer(const void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+{
 	VkBuffer stagingBuffer;
 	VkDeviceMemory stagingBufferMemory;
 
@@ -517,17 +555,133 @@ void MRenderer::createVertexBuffer()
 
 	void* data;
 	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertices.data(), (size_t)bufferSize);
+	memcpy(data, bufferData, (size_t)bufferSize);
 	vkUnmapMemory(device, stagingBufferMemory);
 
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
 
-	copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+	copyBuffer(stagingBuffer, buffer, bufferSize);
 
 	vkDestroyBuffer(device, stagingBuffer, nullptr);
 	vkFreeMemory(device, stagingBufferMemory, nullptr);
 }
 
+void MRenderer::createCubeBuffers()
+{
+	if(cubeInstances.empty() && !lodTree) return;
+
+	// The unit cube every instance is scaled from, colored by position like appendCube
+	std::vector<Vertex> cubeVertices;
+	for(int i = 0; i < 8; ++i)
+	{
+		const glm::vec3 pos{float(((i + 1) / 2) % 2), float((i / 2) % 2), float(i / 4)};
+		cubeVertices.push_back({pos, pos});
+	}
+	const uint16_t cubeIndices[] = {
+		0, 1, 2,  0, 2, 3,
+		4, 5, 6,  4, 6, 7,
+		0, 1, 5,  0, 5, 4,
+		2, 3, 7,  2, 7, 6,
+		0, 3, 7,  0, 7, 4,
+		1, 2, 6,  1, 6, 5
+	};
+
+	createStagedBuffer(cubeVertices.data(), sizeof(cubeVertices[0]) * cubeVertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, cubeVertexBuffer, cubeVertexBufferMemory);
+	createStagedBuffer(cubeIndices, sizeof(cubeIndices), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, cubeIndexBuffer, cubeIndexBufferMemory);
+	if(!lodTree)
+	{
+		createStagedBuffer(cubeInstances.data(), sizeof(cubeInstances[0]) * cubeInstances.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, instanceBuffer, instanceBufferMemory);
+		return;
+	}
+
+	const VkDeviceSize bufferSize = sizeof(CubeInstance) * std::max<size_t>(lodTree->root ? lodTree->root->blackCount : 0, 1);
+	lodInstanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	lodInstanceBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	lodInstanceBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+	lodInstanceCounts.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, lodInstanceBuffers[i], lodInstanceBuffersMemory[i]);
+
+		vkMapMemory(device, lodInstanceBuffersMemory[i], 0, bufferSize, 0, &lodInstanceBuffersMapped[i]);
+	}
+}
+
+void MRenderer::createChunkDrawBuffers()
+{
+	if(meshChunks.levels.empty()) return;
+
+	const VkDeviceSize bufferSize = sizeof(VkDrawIndexedIndirectCommand) * meshChunks.levels.back().size();
+	chunkDrawBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	chunkDrawBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	chunkDrawBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+	chunkDrawCounts.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		createBuffer(bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, chunkDrawBuffers[i], chunkDrawBuffersMemory[i]);
+
+		vkMapMemory(device, chunkDrawBuffersMemory[i], 0, bufferSize, 0, &chunkDrawBuffersMapped[i]);
+	}
+}
+
+void MRenderer::appendChunkDraws(const Frustum& frustum, int nearestChild, size_t level, size_t node, bool bInside)
+{
+	const MeshChunk& chunk = meshChunks.levels[level][node];
+	if(chunk.indexCount == 0) return;
+
+	if(!bInside)
+	{
+		const FrustumSide side = classifyBox(frustum, chunk.boundsMin, chunk.boundsMax);
+		if(side == FRUSTUM_OUTSIDE) return;
+		bInside = side == FRUSTUM_INSIDE;
+	}
+
+	// Nodes inside still go down to the chunks, since their runs are in Morton rather than view order
+	if(level + 1 < meshChunks.levels.size())
+	{
+		for(int i = 0; i < 8; ++i)
+		{
+			appendChunkDraws(frustum, nearestChild, level + 1, 8 * node + (i ^ nearestChild), bInside);
+		}
+		return;
+	}
+
+	// A run continuing the last draw extends it, which joins the chunks back up when they come in index order
+	if(!chunkDraws.empty() && chunkDraws.back().firstIndex + chunkDraws.back().indexCount == chunk.firstIndex)
+	{
+		chunkDraws.back().indexCount += chunk.indexCount;
+		return;
+	}
+	chunkDraws.push_back({chunk.indexCount, 1, chunk.firstIndex, 0, 0});
+}
+
+void MRenderer::updateChunkDraws(uint32_t currentImage)
+{
+	// The model matrix is the identity, as in updateUniformBuffer
+	const Frustum frustum = extractFrustum(getProjectionMatrix() * Camera.GetViewMatrix());
+
+	// Flipping a slot bit wherever Front points down that axis puts the child facing the camera first
+	const int nearestChild = (Camera.Front.x < 0.f ? 1 : 0) | (Camera.Front.y < 0.f ? 2 : 0) | (Camera.Front.z < 0.f ? 4 : 0);
+
+	chunkDraws.clear();
+	appendChunkDraws(frustum, nearestChild, 0, 0, false);
+
+	memcpy(chunkDrawBuffersMapped[currentImage], chunkDraws.data(), sizeof(VkDrawIndexedIndirectCommand) * chunkDraws.size());
+	chunkDrawCounts[currentImage] = static_cast<uint32_t>(chunkDraws.size());
+}
+
+void MRenderer::updateLodInstances(uint32_t currentImage)
+{
+	// Screen height of a unit length at distance one, read back from the projection in updateUniformBuffer
+	const float pixelsPerUnit = 0.5f * swapChainExtent.height * std::abs(getProjectionMatrix()[1][1]);
+
+	lodInstances.clear();
+	populateCubeInstances(*lodTree, Camera.Position, pixelsPerUnit, lodMinChildPixels, lodInstances);
+
+	memcpy(lodInstanceBuffersMapped[currentImage], lodInstances.data(), sizeof(CubeInstance) * lodInstances.size());
+	lodInstanceCounts[currentImage] = static_cast<uint32_t>(lodInstances.size());
+}
+
 VkCommandBuffer MRenderer::beginSingleTimeCommands()
 {
 	VkCommandBufferAllocateInfo allocInfo{};
@@ -669,12 +823,42 @@ void MRenderer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imag
 	scissor.extent = swapChainExtent;
 	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-	VkBuffer vertexBuffers[] = { vertexBuffer };
-	VkDeviceSize offsets[] = { 0 };
-	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
 	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
-	vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+
+	const size_t indexCount = indexType == VK_INDEX_TYPE_UINT16 ? shortIndices.size() : indices.size();
+	if(indexCount > 0)
+	{
+		VkBuffer vertexBuffers[] = { vertexBuffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+		if(meshChunks.levels.empty())
+		{
+			vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indexCount), 1, 0, 0, 0);
+		}
+		else if(bMultiDrawIndirect)
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, chunkDrawBuffers[currentFrame], 0, chunkDrawCounts[currentFrame], sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			for (uint32_t i = 0; i < chunkDrawCounts[currentFrame]; i++) {
+				vkCmdDrawIndexedIndirect(commandBuffer, chunkDrawBuffers[currentFrame], i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+			}
+		}
+	}
+
+	const uint32_t instanceCount = lodTree ? lodInstanceCounts[currentFrame] : static_cast<uint32_t>(cubeInstances.size());
+	if(instanceCount > 0)
+	{
+		// Same layout, so the descriptor set stays bound across the switch
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, instancedPipeline);
+		VkBuffer cubeBuffers[] = { cubeVertexBuffer, lodTree ? lodInstanceBuffers[currentFrame] : instanceBuffer };
+		VkDeviceSize cubeOffsets[] = { 0, 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 2, cubeBuffers, cubeOffsets);
+		vkCmdBindIndexBuffer(commandBuffer, cubeIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
+		vkCmdDrawIndexed(commandBuffer, 36, instanceCount, 0, 0, 0);
+	}
         
 	vkCmdEndRenderPass(commandBuffer);
 
@@ -915,6 +1099,31 @@ void MRenderer::createGraphicsPipeline()
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
 
+	if(!cubeInstances.empty() || lodTree)
+	{
+		// Same state, but the vertex stage places the unit cube with the per instance attributes
+		auto instancedVertShaderCode = readFile("shaders/instanced_vert.spv");
+		VkShaderModule instancedVertShaderModule = createShaderModule(instancedVertShaderCode);
+		shaderStages[0].module = instancedVertShaderModule;
+
+		auto instanceAttributeDescriptions = CubeInstance::getAttributeDescriptions();
+		VkVertexInputBindingDescription instancedBindings[] = { bindingDescription, CubeInstance::getBindingDescription() };
+		VkVertexInputAttributeDescription instancedAttributes[] = {
+			attributeDescriptions[0], attributeDescriptions[1], attributeDescriptions[2],
+			instanceAttributeDescriptions[0], instanceAttributeDescriptions[1]
+		};
+		vertexInputInfo.vertexBindingDescriptionCount = 2;
+		vertexInputInfo.pVertexBindingDescriptions = instancedBindings;
+		vertexInputInfo.vertexAttributeDescriptionCount = 5;
+		vertexInputInfo.pVertexAttributeDescriptions = instancedAttributes;
+
+		if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &instancedPipeline) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create instanced graphics pipeline!");
+		}
+
+		vkDestroyShaderModule(device, instancedVertShaderModule, nullptr);
+	}
+
 	vkDestroyShaderModule(device, fragShaderModule, nullptr);
 	vkDestroyShaderModule(device, geomShaderModule, nullptr);
 	vkDestroyShaderModule(device, vertShaderModule, nullptr);
@@ -1130,6 +1339,11 @@ void MRenderer::createLogicalDevice()
 
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
 	deviceFeatures.geometryShader = VK_TRUE;
+	// Without it, culled chunks are drawn with one indirect call each
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	bMultiDrawIndirect = supportedFeatures.multiDrawIndirect == VK_TRUE;
 	createInfo.pEnabledFeatures = &deviceFeatures;
 
 	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
@@ -1475,6 +1689,10 @@ void MRenderer::drawFrame()
 
 	vkResetFences(device, 1, &inFlightFences[currentFrame]);
 	vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+	if(lodTree)
+		updateLodInstances(currentFrame);
+	if(!meshChunks.levels.empty())
+		updateChunkDraws(currentFrame);
 	recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
 
 	updateUniformBuffer(currentFrame);
@@ -1539,16 +1757,24 @@ void MRenderer::updateUniformBuffer(uint32_t currentImage)
 
 	ubo.view = Camera.GetViewMatrix();
 
-	//ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
-	ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 100.0f);
+	ubo.proj = getProjectionMatrix();
 
-	ubo.proj[1][1] *= -1;
+	ubo.cubeRootExtent = cubeRootExtent;
 
 	memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
 
 
 }
 
+glm::mat4 MRenderer::getProjectionMatrix() const
+{
+	//glm::mat4 proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 100.0f);
+
+	proj[1][1] *= -1;
+	return proj;
+}
+
 void MRenderer::recreateSwapChain()
 {
 	int width = 0, height = 0;
@@ -1605,6 +1831,21 @@ void MRenderer::cleanup()
 	vkFreeMemory(device, indexBufferMemory, nullptr);
 	vkDestroyBuffer(device, vertexBuffer, nullptr);
 	vkFreeMemory(device, vertexBufferMemory, nullptr);
+	vkDestroyBuffer(device, instanceBuffer, nullptr);
+	vkFreeMemory(device, instanceBufferMemory, nullptr);
+	for (size_t i = 0; i < lodInstanceBuffers.size(); i++) {
+		vkDestroyBuffer(device, lodInstanceBuffers[i], nullptr);
+		vkFreeMemory(device, lodInstanceBuffersMemory[i], nullptr);
+	}
+	for (size_t i = 0; i < chunkDrawBuffers.size(); i++) {
+		vkDestroyBuffer(device, chunkDrawBuffers[i], nullptr);
+		vkFreeMemory(device, chunkDrawBuffersMemory[i], nullptr);
+	}
+	vkDestroyBuffer(device, cubeIndexBuffer, nullptr);
+	vkFreeMemory(device, cubeIndexBufferMemory, nullptr);
+	vkDestroyBuffer(device, cubeVertexBuffer, nullptr);
+	vkFreeMemory(device, cubeVertexBufferMemory, nullptr);
+	vkDestroyPipeline(device, instancedPipeline, nullptr);
 	vkDestroyPipeline(device, graphicsPipeline, nullptr);
 	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 	vkDestroyRenderPass(device, renderPass, nullptr);
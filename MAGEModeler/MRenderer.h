@@ -22,6 +22,8 @@
 #include <array>
 #include "MCamera.h"
 #include "MModel.h"
+#include "MOctree.h"
+#include "MFrustum.h"
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
@@ -31,12 +33,22 @@ struct UniformBufferObject {
     glm::mat4 model;
     glm::mat4 view;
     glm::mat4 proj;
+    // World extent of a depth zero CubeInstance, halved per level in instanced.vert
+    glm::vec3 cubeRootExtent;
 };
 
 class MRenderer
 {
 public:
     void run(std::vector<Vertex>& inVertices, std::vector<uint32_t>& inIndices);
+    // For meshes with at most 65536 vertices, half the index buffer
+    void run(std::vector<Vertex>& inVertices, std::vector<uint16_t>& inIndices);
+    // Draws inInstances off one unit cube with a single instanced call, next to the mesh
+    void run(std::vector<Vertex>& inVertices, std::vector<uint32_t>& inIndices, std::vector<CubeInstance>& inInstances, const glm::vec3& inCubeRootExtent);
+    // Draws inTree as cubes cut each frame from the camera distance, GREY nodes standing in for sub-pixel children
+    void run(std::vector<Vertex>& inVertices, std::vector<uint32_t>& inIndices, const Octree& inTree);
+    // Set before run, on the same indices: each frame only the chunks in the view frustum are drawn, indirectly
+    void setMeshChunks(ChunkedMesh inChunks);
     
     inline static bool firstMouse = true;
     inline static float lastX = 800.f;
@@ -100,6 +112,7 @@ private:
     VkDescriptorSetLayout descriptorSetLayout;
     VkPipelineLayout pipelineLayout;
     VkPipeline graphicsPipeline;
+    VkPipeline instancedPipeline = VK_NULL_HANDLE;
     std::vector<VkFramebuffer> swapChainFramebuffers;
     VkCommandPool commandPool;
     VkCommandPool copyBufferCommandPool;
@@ -112,10 +125,37 @@ private:
     uint32_t currentFrame = 0;
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
-    VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
-    VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    std::vector<uint16_t> shortIndices;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    VkBuffer vertexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
+    std::vector<CubeInstance> cubeInstances;
+    glm::vec3 cubeRootExtent = glm::vec3(0.f);
+    VkBuffer cubeVertexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory cubeVertexBufferMemory = VK_NULL_HANDLE;
+    VkBuffer cubeIndexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory cubeIndexBufferMemory = VK_NULL_HANDLE;
+    VkBuffer instanceBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory instanceBufferMemory = VK_NULL_HANDLE;
+    const Octree* lodTree = nullptr;
+    // Children covering fewer pixels than this are drawn as their parent's cube
+    float lodMinChildPixels = 1.f;
+    std::vector<CubeInstance> lodInstances;
+    // Host visible, one per frame in flight, sized for every BLACK leaf, which bounds any cut
+    std::vector<VkBuffer> lodInstanceBuffers;
+    std::vector<VkDeviceMemory> lodInstanceBuffersMemory;
+    std::vector<void*> lodInstanceBuffersMapped;
+    std::vector<uint32_t> lodInstanceCounts;
+    ChunkedMesh meshChunks;
+    bool bMultiDrawIndirect = false;
+    std::vector<VkDrawIndexedIndirectCommand> chunkDraws;
+    // Host visible, one per frame in flight, sized for a draw per chunk, which bounds any frustum
+    std::vector<VkBuffer> chunkDrawBuffers;
+    std::vector<VkDeviceMemory> chunkDrawBuffersMemory;
+    std::vector<void*> chunkDrawBuffersMapped;
+    std::vector<uint32_t> chunkDrawCounts;
 
     std::vector<VkBuffer> uniformBuffers;
     std::vector<VkDeviceMemory> uniformBuffersMemory;
@@ -196,6 +236,22 @@ private:
 
     void createVertexBuffer();
 
+    // Device local buffer filled with data through a staging buffer
+    void createStagedBuffer(const void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+
+    void createCubeBuffers();
+
+    void updateLodInstances(uint32_t currentImage);
+
+    void createChunkDrawBuffers();
+
+    // Children visited from slot nearestChild outwards, so the draws come front to back
+    void appendChunkDraws(const Frustum& frustum, int nearestChild, size_t level, size_t node, bool bInside);
+
+    void updateChunkDraws(uint32_t currentImage);
+
+    glm::mat4 getProjectionMatrix() const;
+
     VkCommandBuffer beginSingleTimeCommands();
 
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
@@ -0,0 +1,167 @@
+﻿#include "MTaskScheduler.h"
+#include <algorithm>
+
+namespace
+{
+	// Index of the calling thread in its scheduler, -1 outside the pool
+	thread_local const MTaskScheduler* currentScheduler = nullptr;
+	thread_local int currentWorker = -1;
+}
+
+MTaskScheduler::MTaskScheduler(unsigned threadCount)
+{
+	threadCount = std::max(threadCount, 1u);
+	for(unsigned i = 0; i < threadCount; ++i)
+	{
+		queues.push_back(std::make_unique<WorkerQueue>());
+	}
+	for(unsigned i = 0; i < threadCount; ++i)
+	{
+		workers.emplace_back(&MTaskScheduler::workerLoop, this, i);
+	}
+}
+
+MTaskScheduler::~MTaskScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		bStopping = true;
+	}
+	sleepCondition.notify_all();
+	for(std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void MTaskScheduler::run(TaskGroup& group, std::function<void()> task)
+{
+	group.pending.fetch_add(1, std::memory_order_relaxed);
+
+	WorkerQueue& queue = (currentScheduler == this && currentWorker >= 0) ? *queues[currentWorker] : injectionQueue;
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back({std::move(task), &group});
+	}
+
+	queuedTasks.fetch_add(1, std::memory_order_release);
+	{
+		// Taking the lock orders this against a worker that is about to sleep
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	sleepCondition.notify_one();
+}
+
+void MTaskScheduler::wait(TaskGroup& group)
+{
+	const int workerIndex = currentScheduler == this ? currentWorker : -1;
+	while(group.pending.load(std::memory_order_acquire) > 0)
+	{
+		if(!tryRunTask(workerIndex))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	if(group.error)
+	{
+		std::exception_ptr error = group.error;
+		group.error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void MTaskScheduler::workerLoop(unsigned workerIndex)
+{
+	currentScheduler = this;
+	currentWorker = static_cast<int>(workerIndex);
+
+	while(true)
+	{
+		if(tryRunTask(currentWorker))
+		{
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleepCondition.wait(lock, [this] { return bStopping || queuedTasks.load(std::memory_order_acquire) > 0; });
+		if(bStopping)
+		{
+			return;
+		}
+	}
+}
+
+bool MTaskScheduler::tryRunTask(int workerIndex)
+{
+	Task task;
+	if(!popTask(workerIndex, task))
+	{
+		return false;
+	}
+
+	execute(task);
+	return true;
+}
+
+bool MTaskScheduler::popTask(int workerIndex, Task& task)
+{
+	if(workerIndex >= 0)
+	{
+		WorkerQueue& own = *queues[workerIndex];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if(!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(injectionQueue.mutex);
+		if(!injectionQueue.tasks.empty())
+		{
+			task = std::move(injectionQueue.tasks.front());
+			injectionQueue.tasks.pop_front();
+			queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	// Steal, starting after our own slot so thieves spread over the victims
+	const size_t queueCount = queues.size();
+	const size_t start = workerIndex >= 0 ? static_cast<size_t>(workerIndex) + 1 : 0;
+	for(size_t i = 0; i < queueCount; ++i)
+	{
+		WorkerQueue& victim = *queues[(start + i) % queueCount];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if(!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void MTaskScheduler::execute(Task& task)
+{
+	try
+	{
+		task.function();
+	}
+	catch(...)
+	{
+		std::lock_guard<std::mutex> lock(task.group->errorMutex);
+		if(!task.group->error)
+		{
+			task.group->error = std::current_exception();
+		}
+	}
+	task.group->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
@@ -0,0 +1,75 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Work-stealing task scheduler. Every worker owns a deque: it pushes and pops its own
+ * tasks at the back (depth first, cache warm) and steals from the front of the others
+ * (the oldest, usually biggest subtrees). Tasks submitted from outside the pool go to
+ * a shared injection queue.
+ */
+class MTaskScheduler
+{
+public:
+	// Tasks spawned through run() count against the group until they finish
+	class TaskGroup
+	{
+	public:
+		TaskGroup() = default;
+		TaskGroup(const TaskGroup&) = delete;
+		TaskGroup& operator=(const TaskGroup&) = delete;
+
+	private:
+		friend class MTaskScheduler;
+		std::atomic<size_t> pending{0};
+		std::mutex errorMutex;
+		std::exception_ptr error;
+	};
+
+	explicit MTaskScheduler(unsigned threadCount = std::thread::hardware_concurrency());
+	MTaskScheduler(const MTaskScheduler&) = delete;
+	MTaskScheduler& operator=(const MTaskScheduler&) = delete;
+	~MTaskScheduler();
+
+	void run(TaskGroup& group, std::function<void()> task);
+
+	// Runs queued tasks on the calling thread until every task of the group is done,
+	// then rethrows the first exception one of them threw
+	void wait(TaskGroup& group);
+
+	unsigned getThreadCount() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+	struct Task
+	{
+		std::function<void()> function;
+		TaskGroup* group;
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::vector<std::thread> workers;
+	WorkerQueue injectionQueue;
+
+	std::mutex sleepMutex;
+	std::condition_variable sleepCondition;
+	std::atomic<size_t> queuedTasks{0};
+	std::atomic<bool> bStopping{false};
+
+	void workerLoop(unsigned workerIndex);
+	bool tryRunTask(int workerIndex);
+	bool popTask(int workerIndex, Task& task);
+	void execute(Task& task);
+};
@@ -0,0 +1,183 @@
+﻿#include "MTriangleBox.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/geometric.hpp>
+
+#if defined(__AVX__)
+#define MAGE_TRIBOX_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MAGE_TRIBOX_SSE
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// Lane backends for separatedLanes(): one float per lane, masks reduce to one bit per lane
+	struct ScalarLanes
+	{
+		using Float = float;
+		using Mask = bool;
+
+		static Float load(const float* p) { return *p; }
+		static Float set(float f) { return f; }
+		static Float add(Float a, Float b) { return a + b; }
+		static Float sub(Float a, Float b) { return a - b; }
+		static Float mul(Float a, Float b) { return a * b; }
+		static Float min(Float a, Float b) { return std::min(a, b); }
+		static Float max(Float a, Float b) { return std::max(a, b); }
+		static Float abs(Float a) { return std::fabs(a); }
+		static Mask greater(Float a, Float b) { return a > b; }
+		static Mask either(Mask a, Mask b) { return a || b; }
+		static uint32_t bits(Mask m) { return m ? 1u : 0u; }
+	};
+
+#ifdef MAGE_TRIBOX_SSE
+	struct SseLanes
+	{
+		using Float = __m128;
+		using Mask = __m128;
+
+		static Float load(const float* p) { return _mm_load_ps(p); }
+		static Float set(float f) { return _mm_set1_ps(f); }
+		static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+		static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+		static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+		static Float min(Float a, Float b) { return _mm_min_ps(a, b); }
+		static Float max(Float a, Float b) { return _mm_max_ps(a, b); }
+		static Float abs(Float a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+		static Mask greater(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+		static Mask either(Mask a, Mask b) { return _mm_or_ps(a, b); }
+		static uint32_t bits(Mask m) { return static_cast<uint32_t>(_mm_movemask_ps(m)); }
+	};
+#endif
+
+#ifdef MAGE_TRIBOX_AVX
+	struct AvxLanes
+	{
+		using Float = __m256;
+		using Mask = __m256;
+
+		static Float load(const float* p) { return _mm256_load_ps(p); }
+		static Float set(float f) { return _mm256_set1_ps(f); }
+		static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+		static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+		static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+		static Float min(Float a, Float b) { return _mm256_min_ps(a, b); }
+		static Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+		static Float abs(Float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+		static Mask greater(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+		static Mask either(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+		static uint32_t bits(Mask m) { return static_cast<uint32_t>(_mm256_movemask_ps(m)); }
+	};
+#endif
+
+	// Separated when all three projections lie on one side of [-rad, rad]
+	template<typename L>
+	typename L::Mask outside(typename L::Float p0, typename L::Float p1, typename L::Float p2, typename L::Float rad)
+	{
+		const typename L::Float minP = L::min(p0, L::min(p1, p2));
+		const typename L::Float maxP = L::max(p0, L::max(p1, p2));
+		return L::either(L::greater(minP, rad), L::greater(L::sub(L::set(0.0f), rad), maxP));
+	}
+
+	// Bit set per lane that has a separating axis. coords point at lane 0 of each vertex
+	// coordinate array followed by the three normal arrays
+	template<typename L>
+	uint32_t separatedLanes(const float* const coords[12], const glm::vec3& boxCenter, const glm::vec3& boxHalfSize)
+	{
+		using F = typename L::Float;
+		using M = typename L::Mask;
+
+		const F hx = L::set(boxHalfSize.x);
+		const F hy = L::set(boxHalfSize.y);
+		const F hz = L::set(boxHalfSize.z);
+		const F cx = L::set(boxCenter.x);
+		const F cy = L::set(boxCenter.y);
+		const F cz = L::set(boxCenter.z);
+
+		// Move the box to the origin
+		const F v0x = L::sub(L::load(coords[0]), cx), v0y = L::sub(L::load(coords[1]), cy), v0z = L::sub(L::load(coords[2]), cz);
+		const F v1x = L::sub(L::load(coords[3]), cx), v1y = L::sub(L::load(coords[4]), cy), v1z = L::sub(L::load(coords[5]), cz);
+		const F v2x = L::sub(L::load(coords[6]), cx), v2y = L::sub(L::load(coords[7]), cy), v2z = L::sub(L::load(coords[8]), cz);
+
+		// Box face normals: the triangle's bounds against the box
+		M separated = outside<L>(v0x, v1x, v2x, hx);
+		separated = L::either(separated, outside<L>(v0y, v1y, v2y, hy));
+		separated = L::either(separated, outside<L>(v0z, v1z, v2z, hz));
+
+		const F e0x = L::sub(v1x, v0x), e0y = L::sub(v1y, v0y), e0z = L::sub(v1z, v0z);
+		const F e1x = L::sub(v2x, v1x), e1y = L::sub(v2y, v1y), e1z = L::sub(v2z, v1z);
+		const F e2x = L::sub(v0x, v2x), e2y = L::sub(v0y, v2y), e2z = L::sub(v0z, v2z);
+
+		// Triangle normal: the plane's distance to the box center against the box's extent on it
+		const F nx = L::load(coords[9]);
+		const F ny = L::load(coords[10]);
+		const F nz = L::load(coords[11]);
+		const F distance = L::add(L::add(L::mul(nx, v0x), L::mul(ny, v0y)), L::mul(nz, v0z));
+		const F normalRadius = L::add(L::add(L::mul(hx, L::abs(nx)), L::mul(hy, L::abs(ny))), L::mul(hz, L::abs(nz)));
+		separated = L::either(separated, L::greater(L::abs(distance), normalRadius));
+
+		// Edge x box axis cross products
+		const F edges[3][3] = {{e0x, e0y, e0z}, {e1x, e1y, e1z}, {e2x, e2y, e2z}};
+		for(const auto& e : edges)
+		{
+			const F ax = L::abs(e[0]);
+			const F ay = L::abs(e[1]);
+			const F az = L::abs(e[2]);
+
+			// X x e
+			separated = L::either(separated, outside<L>(
+				L::sub(L::mul(e[2], v0y), L::mul(e[1], v0z)),
+				L::sub(L::mul(e[2], v1y), L::mul(e[1], v1z)),
+				L::sub(L::mul(e[2], v2y), L::mul(e[1], v2z)),
+				L::add(L::mul(hy, az), L::mul(hz, ay))));
+			// Y x e
+			separated = L::either(separated, outside<L>(
+				L::sub(L::mul(e[0], v0z), L::mul(e[2], v0x)),
+				L::sub(L::mul(e[0], v1z), L::mul(e[2], v1x)),
+				L::sub(L::mul(e[0], v2z), L::mul(e[2], v2x)),
+				L::add(L::mul(hx, az), L::mul(hz, ax))));
+			// Z x e
+			separated = L::either(separated, outside<L>(
+				L::sub(L::mul(e[1], v0x), L::mul(e[0], v0y)),
+				L::sub(L::mul(e[1], v1x), L::mul(e[0], v1y)),
+				L::sub(L::mul(e[1], v2x), L::mul(e[0], v2y)),
+				L::add(L::mul(hx, ay), L::mul(hy, ax))));
+		}
+
+		return L::bits(separated);
+	}
+}
+
+bool triBoxOverlap(const glm::vec3& boxCenter, const glm::vec3& boxHalfSize, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+{
+	const glm::vec3 normal = glm::cross(v1 - v0, v2 - v0);
+	const float* const coords[12] = {&v0.x, &v0.y, &v0.z, &v1.x, &v1.y, &v1.z, &v2.x, &v2.y, &v2.z, &normal.x, &normal.y, &normal.z};
+	return separatedLanes<ScalarLanes>(coords, boxCenter, boxHalfSize) == 0;
+}
+
+uint32_t triBoxOverlap(const TriangleBatch& batch, const glm::vec3& boxCenter, const glm::vec3& boxHalfSize)
+{
+	const uint32_t validLanes = batch.count >= 32 ? ~0u : (1u << batch.count) - 1u;
+	uint32_t separated = 0;
+
+#if defined(MAGE_TRIBOX_AVX)
+	const float* const coords[12] = {batch.coords[0], batch.coords[1], batch.coords[2], batch.coords[3], batch.coords[4], batch.coords[5], batch.coords[6], batch.coords[7], batch.coords[8], batch.normals[0], batch.normals[1], batch.normals[2]};
+	separated = separatedLanes<AvxLanes>(coords, boxCenter, boxHalfSize);
+#elif defined(MAGE_TRIBOX_SSE)
+	for(uint32_t first = 0; first < batch.count; first += 4)
+	{
+		const float* const coords[12] = {batch.coords[0] + first, batch.coords[1] + first, batch.coords[2] + first, batch.coords[3] + first, batch.coords[4] + first, batch.coords[5] + first, batch.coords[6] + first, batch.coords[7] + first, batch.coords[8] + first, batch.normals[0] + first, batch.normals[1] + first, batch.normals[2] + first};
+		separated |= separatedLanes<SseLanes>(coords, boxCenter, boxHalfSize) << first;
+	}
+#else
+	for(uint32_t lane = 0; lane < batch.count; ++lane)
+	{
+		const float* const coords[12] = {batch.coords[0] + lane, batch.coords[1] + lane, batch.coords[2] + lane, batch.coords[3] + lane, batch.coords[4] + lane, batch.coords[5] + lane, batch.coords[6] + lane, batch.coords[7] + lane, batch.coords[8] + lane, batch.normals[0] + lane, batch.normals[1] + lane, batch.normals[2] + lane};
+		separated |= separatedLanes<ScalarLanes>(coords, boxCenter, boxHalfSize) << lane;
+	}
+#endif
+
+	return ~separated & validLanes;
+}
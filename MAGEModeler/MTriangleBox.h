@@ -0,0 +1,25 @@
+﻿#pragma once
+#include <cstdint>
+#include <glm/vec3.hpp>
+
+constexpr uint32_t TRIANGLE_BATCH_WIDTH = 8;
+
+/*
+ * Up to TRIANGLE_BATCH_WIDTH triangles laid out as structure of arrays, so one SIMD
+ * register holds the same coordinate of every triangle: coords[0..2] = v0.xyz,
+ * coords[3..5] = v1.xyz, coords[6..8] = v2.xyz. normals may be of any length but must
+ * point along cross(v1 - v0, v2 - v0).
+ */
+struct TriangleBatch
+{
+	alignas(32) float coords[9][TRIANGLE_BATCH_WIDTH]{};
+	alignas(32) float normals[3][TRIANGLE_BATCH_WIDTH]{};
+	uint32_t count = 0;
+};
+
+// Akenine-Moller separating axis test, touching counts as overlap
+bool triBoxOverlap(const glm::vec3& boxCenter, const glm::vec3& boxHalfSize, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2);
+
+// Bit i is set when triangle i of the batch overlaps the box. Uses AVX when the build
+// enables it (/arch:AVX2), SSE on any x86-64 target and the scalar test otherwise.
+uint32_t triBoxOverlap(const TriangleBatch& batch, const glm::vec3& boxCenter, const glm::vec3& boxHalfSize);
@@ -1,4 +1,5 @@
 E:/VulkanSDK/1.3.275.0/Bin/glslc.exe shader.vert -o vert.spv
 E:/VulkanSDK/1.3.275.0/Bin/glslc.exe shader.geom -o geom.spv
 E:/VulkanSDK/1.3.275.0/Bin/glslc.exe shader.frag -o frag.spv
+E:/VulkanSDK/1.3.275.0/Bin/glslc.exe instanced.vert -o instanced_vert.spv
 pause
\ No newline at end of file
@@ -0,0 +1,28 @@
+#version 450
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    vec3 cubeRootExtent;
+} ubo;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+// Per instance: the leaf's min corner and depth below the root
+layout(location = 3) in vec3 inCubeMin;
+layout(location = 4) in uint inCubeDepth;
+
+layout(location = 0) out VS_OUT {
+    vec3 fragColor;
+} vs_out;
+layout(location = 1) out vec2 fragTexCoord;
+
+void main() {
+    // Each level halves the root box along every axis
+    vec3 cubeExtent = ubo.cubeRootExtent * exp2(-float(inCubeDepth));
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inCubeMin + inPosition * cubeExtent, 1.0);
+    vs_out.fragColor = inColor;
+    fragTexCoord = inTexCoord;
+}
\ No newline at end of file